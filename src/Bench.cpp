@@ -0,0 +1,440 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+// Benchmark of QuadTree against a brute-force array of values.
+// Build it in Release: the assertions of a debug build dominate the times.
+//
+// QuadTreeBench [--max-exp N] [--format csv|json] [--out FILE]
+//               [--queries N] [--brute-max N] [--seed N] [--threads N]
+//
+// Every workload runs at 10^3 .. 10^max-exp values, max-exp is 5 by default
+// and 7 at most. The brute force runs up to brute-max values only,
+// its removal and query are linear in the count of values.
+// The queries of QuadTreeParallel run on 1, 2, 4 .. threads values of
+// threads, as many as the cores by default.
+
+#include <new>
+#include <cmath>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include "QuadTree.hpp"
+#include "QuadTreeParallel.hpp"
+
+// Live bytes of the heap, for the memory footprint of the structures.
+// Every block keeps its size in a header in front of it. The count is
+// of the thread, a shared one would serialize the parallel queries;
+// the footprints are measured on the main thread only.
+namespace {
+    thread_local std::size_t heap_bytes = 0;
+    std::size_t const header_size = alignof(std::max_align_t);
+}
+
+void* operator new(std::size_t size) {
+    void* block = std::malloc(size + header_size);
+    if (!block) throw std::bad_alloc();
+    *static_cast<std::size_t*>(block) = size;
+    heap_bytes += size;
+    return static_cast<char*>(block) + header_size;
+}
+
+void operator delete(void* pointer) noexcept {
+    if (!pointer) return;
+    void* block = static_cast<char*>(pointer) - header_size;
+    heap_bytes -= *static_cast<std::size_t*>(block);
+    std::free(block);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    operator delete(pointer);
+}
+
+namespace {
+
+using Real = float;
+using BenchBox = Box<Real>;
+using BenchViB = ValueInBox<std::uint32_t, Real>;
+
+class BenchObj: public BenchViB, public ClonableDerived<BenchObj, BenchViB> {
+  public:
+    BenchObj(std::uint32_t id, BenchBox box): id(id), box(box) { }
+    BenchBox getBox() const override { return box; }
+    std::uint32_t& getValue() override { return id; }
+    
+  private:
+    std::uint32_t id;
+    BenchBox box;
+};
+
+using Tree = QuadTree<std::uint32_t, Real>;
+using ParallelTree = QuadTreeParallel<std::uint32_t, Real>;
+using ValPtr = BenchViB::Ptr;
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct Options {
+    int max_exp = 5;
+    std::string format = "csv";
+    std::string out;
+    std::size_t queries = 1000;
+    std::size_t brute_max = 10000;
+    unsigned seed = 42;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+struct Row {
+    std::string workload;
+    std::size_t count;
+    std::string structure;
+    std::string operation;
+    std::size_t operations;
+    double seconds;
+    // Matches of the queries, or bytes of the memory footprint
+    std::size_t result;
+};
+
+// Values of one run and the motion of the moving workload
+struct Workload {
+    std::string name;
+    BenchBox world;
+    std::vector<BenchBox> boxes;
+    std::vector<Vector2<Real>> velocities;
+    std::vector<BenchBox> queries;
+};
+
+// The world grows with the count, so the density of values and the count
+// of matches per query stay the same at every scale. Every hundredth value
+// is large and straddles the quadrants of the upper nodes.
+Real valueSize(std::size_t i, std::mt19937& random) {
+    std::uniform_real_distribution<Real> unit(0, 1);
+    return (i % 100 == 0 ? Real(40) : Real(4)) * (Real(0.25) + unit(random));
+}
+
+// Keeps a margin from the borders of the world: the right and bottom of
+// a quadrant are computed by halving, a value touching the border of the
+// world may lie a rounding step out of the quadrant that takes it
+BenchBox clamped(BenchBox box, BenchBox const& world) {
+    Real const margin = 1;
+    box.left = std::min(std::max(box.left, world.left + margin), world.getRight() - margin - box.width);
+    box.top = std::min(std::max(box.top, world.top + margin), world.getBottom() - margin - box.height);
+    return box;
+}
+
+Workload makeWorkload(std::string const& name, std::size_t count, Options const& options) {
+    std::mt19937 random(options.seed);
+    std::uniform_real_distribution<Real> unit(0, 1);
+    Real side = 10 * std::sqrt(static_cast<Real>(count));
+    
+    Workload workload;
+    workload.name = name;
+    workload.world = BenchBox(0, 0, side, side);
+    workload.boxes.reserve(count);
+    
+    if (name == "clustered") {
+        // Gaussian blobs holding every value, most of the world stays empty
+        std::vector<Vector2<Real>> centers(16);
+        for (Vector2<Real>& center: centers) {
+            center = Vector2<Real>(side * unit(random), side * unit(random));
+        }
+        std::normal_distribution<Real> offset(0, side / 40);
+        for (std::size_t i = 0; i != count; ++i) {
+            Vector2<Real> const& center = centers[i % centers.size()];
+            Real size = valueSize(i, random);
+            BenchBox box(center.x + offset(random), center.y + offset(random), size, size);
+            workload.boxes.push_back(clamped(box, workload.world));
+        }
+    } else {
+        for (std::size_t i = 0; i != count; ++i) {
+            Real size = valueSize(i, random);
+            BenchBox box((side - size) * unit(random), (side - size) * unit(random), size, size);
+            workload.boxes.push_back(clamped(box, workload.world));
+        }
+    }
+    
+    if (name == "moving") {
+        std::uniform_real_distribution<Real> speed(-2, 2);
+        workload.velocities.reserve(count);
+        for (std::size_t i = 0; i != count; ++i) {
+            workload.velocities.emplace_back(speed(random), speed(random));
+        }
+    }
+    
+    // Queries around the values, so clustered ones hit the blobs
+    std::uniform_int_distribution<std::size_t> pick(0, count - 1);
+    for (std::size_t i = 0; i != options.queries; ++i) {
+        Vector2<Real> center = workload.boxes[pick(random)].getCenter();
+        BenchBox query(center.x - 25, center.y - 25, 50, 50);
+        workload.queries.push_back(query);
+    }
+    return workload;
+}
+
+// Next box of a moving value, bouncing off the world borders
+BenchBox moved(BenchBox box, Vector2<Real>& velocity, BenchBox const& world) {
+    box.left += velocity.x;
+    box.top += velocity.y;
+    if (box.left < world.left || box.getRight() > world.getRight()) velocity.x = -velocity.x;
+    if (box.top < world.top || box.getBottom() > world.getBottom()) velocity.y = -velocity.y;
+    return clamped(box, world);
+}
+
+std::vector<ValPtr> makeValues(Workload const& workload) {
+    std::vector<ValPtr> values;
+    values.reserve(workload.boxes.size());
+    for (std::size_t i = 0; i != workload.boxes.size(); ++i) {
+        values.push_back(std::make_shared<BenchObj>(static_cast<std::uint32_t>(i), workload.boxes[i]));
+    }
+    return values;
+}
+
+// Rounds of removal of a tenth of the values and their addition elsewhere,
+// so the nodes keep splitting and merging
+std::size_t const churn_rounds = 4;
+
+void benchTree(Workload const& workload, std::vector<Row>& rows) {
+    std::size_t count = workload.boxes.size();
+    std::vector<ValPtr> values = makeValues(workload);
+    auto row = [&] (std::string const& operation, std::size_t operations,
+                    double seconds, std::size_t result) {
+        rows.push_back(Row { workload.name, count, "quadtree", operation, operations, seconds, result });
+    };
+    
+    {
+        Tree tree(workload.world);
+        Clock::time_point start = Clock::now();
+        tree.bulkLoad(values.begin(), values.end());
+        row("bulk_load", count, secondsSince(start), tree.size());
+    }
+    
+    std::size_t bytes_before = heap_bytes;
+    Tree tree(workload.world);
+    std::vector<Tree::Handle> handles;
+    handles.reserve(count);
+    Clock::time_point start = Clock::now();
+    for (ValPtr const& value: values) handles.push_back(tree.insert(value));
+    row("add", count, secondsSince(start), tree.size());
+    row("memory", count, 0, heap_bytes - bytes_before - handles.capacity() * sizeof(Tree::Handle));
+    
+    std::size_t matches = 0;
+    start = Clock::now();
+    for (BenchBox const& query: workload.queries) {
+        tree.queryVisit(query, [&matches] (BenchViB const&) {
+            ++matches;
+            return true;
+        });
+    }
+    row("query", workload.queries.size(), secondsSince(start), matches);
+    
+    std::mt19937 random(7);
+    std::uniform_int_distribution<std::size_t> pick(0, count - 1);
+    std::uniform_real_distribution<Real> unit(0, 1);
+    std::size_t churned = 0;
+    start = Clock::now();
+    for (std::size_t round = 0; round != churn_rounds; ++round) {
+        for (std::size_t k = 0; k != count / 10; ++k) {
+            std::size_t i = pick(random);
+            tree.remove(handles[i]);
+            BenchBox box = workload.boxes[i];
+            box.left = (workload.world.width - box.width) * unit(random);
+            box.top = (workload.world.height - box.height) * unit(random);
+            box = clamped(box, workload.world);
+            handles[i] = tree.insert(std::make_shared<BenchObj>(static_cast<std::uint32_t>(i), box));
+            ++churned;
+        }
+    }
+    row("churn", churned, secondsSince(start), tree.size());
+    
+    if (!workload.velocities.empty()) {
+        std::vector<BenchBox> boxes = workload.boxes;
+        std::vector<Vector2<Real>> velocities = workload.velocities;
+        for (std::size_t i = 0; i != count; ++i) boxes[i] = tree.get(handles[i])->getBox();
+        start = Clock::now();
+        for (std::size_t frame = 0; frame != 10; ++frame) {
+            for (std::size_t i = 0; i != count; ++i) {
+                boxes[i] = moved(boxes[i], velocities[i], workload.world);
+                tree.update(handles[i], boxes[i]);
+            }
+        }
+        row("move", 10 * count, secondsSince(start), tree.size());
+    }
+    
+    start = Clock::now();
+    for (Tree::Handle handle: handles) tree.remove(handle);
+    row("remove", count, secondsSince(start), tree.size());
+}
+
+void benchBruteForce(Workload const& workload, std::vector<Row>& rows) {
+    std::size_t count = workload.boxes.size();
+    std::vector<ValPtr> values = makeValues(workload);
+    auto row = [&] (std::string const& operation, std::size_t operations,
+                    double seconds, std::size_t result) {
+        rows.push_back(Row { workload.name, count, "brute_force", operation, operations, seconds, result });
+    };
+    
+    std::size_t bytes_before = heap_bytes;
+    std::vector<ValPtr> stored;
+    std::vector<BenchBox> boxes;
+    Clock::time_point start = Clock::now();
+    for (ValPtr const& value: values) {
+        stored.push_back(value->clone());
+        boxes.push_back(stored.back()->getBox());
+    }
+    row("add", count, secondsSince(start), stored.size());
+    row("memory", count, 0, heap_bytes - bytes_before);
+    
+    std::size_t matches = 0;
+    start = Clock::now();
+    for (BenchBox const& query: workload.queries) {
+        for (BenchBox const& box: boxes) {
+            if (query.intersects(box)) ++matches;
+        }
+    }
+    row("query", workload.queries.size(), secondsSince(start), matches);
+    
+    if (!workload.velocities.empty()) {
+        std::vector<Vector2<Real>> velocities = workload.velocities;
+        start = Clock::now();
+        for (std::size_t frame = 0; frame != 10; ++frame) {
+            for (std::size_t i = 0; i != count; ++i) {
+                boxes[i] = moved(boxes[i], velocities[i], workload.world);
+            }
+        }
+        row("move", 10 * count, secondsSince(start), stored.size());
+    }
+    
+    // Each value is searched for by its id, then replaced by the last one
+    start = Clock::now();
+    for (ValPtr const& value: values) {
+        std::size_t i = 0;
+        while (!(*stored[i] == *value)) ++i;
+        stored[i] = std::move(stored.back());
+        stored.pop_back();
+        boxes[i] = boxes.back();
+        boxes.pop_back();
+    }
+    row("remove", count, secondsSince(start), stored.size());
+}
+
+// Every thread runs all the queries, a row takes the wall time of them all:
+// its ns per query falls as long as the queries scale with the threads
+void benchParallelQuery(Workload const& workload, std::size_t max_threads, std::vector<Row>& rows) {
+    std::size_t count = workload.boxes.size();
+    ParallelTree tree(workload.world);
+    for (ValPtr const& value: makeValues(workload)) tree.add(value);
+    
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+        std::atomic<std::size_t> matches { 0 };
+        std::vector<std::thread> workers;
+        Clock::time_point start = Clock::now();
+        for (std::size_t t = 0; t != threads; ++t) {
+            workers.emplace_back([&] {
+                std::size_t found = 0;
+                for (BenchBox const& query: workload.queries) found += tree.query(query).size();
+                matches += found;
+            });
+        }
+        for (std::thread& worker: workers) worker.join();
+        rows.push_back(Row {
+            workload.name, count, "quadtree_parallel", "query_threads_" + std::to_string(threads),
+            threads * workload.queries.size(), secondsSince(start), matches
+        });
+    }
+}
+
+void writeCsv(std::vector<Row> const& rows, std::ostream& out) {
+    out << "workload,count,structure,operation,operations,seconds,ns_per_operation,result\n";
+    for (Row const& row: rows) {
+        double ns = row.operations != 0 ? row.seconds * 1e9 / static_cast<double>(row.operations) : 0;
+        out << row.workload << ',' << row.count << ',' << row.structure << ','
+            << row.operation << ',' << row.operations << ',' << row.seconds << ','
+            << ns << ',' << row.result << '\n';
+    }
+}
+
+void writeJson(std::vector<Row> const& rows, std::ostream& out) {
+    out << "[\n";
+    for (std::size_t i = 0; i != rows.size(); ++i) {
+        Row const& row = rows[i];
+        double ns = row.operations != 0 ? row.seconds * 1e9 / static_cast<double>(row.operations) : 0;
+        out << "  {\"workload\": \"" << row.workload << "\", \"count\": " << row.count
+            << ", \"structure\": \"" << row.structure << "\", \"operation\": \"" << row.operation
+            << "\", \"operations\": " << row.operations << ", \"seconds\": " << row.seconds
+            << ", \"ns_per_operation\": " << ns << ", \"result\": " << row.result << "}"
+            << (i + 1 != rows.size() ? ",\n" : "\n");
+    }
+    out << "]\n";
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string name = argv[i];
+        if (i + 1 == argc) return false;
+        std::string value = argv[++i];
+        if (name == "--max-exp") {
+            options.max_exp = std::atoi(value.c_str());
+            if (options.max_exp < 3 || options.max_exp > 7) return false;
+        } else if (name == "--format") {
+            options.format = value;
+            if (value != "csv" && value != "json") return false;
+        } else if (name == "--out") {
+            options.out = value;
+        } else if (name == "--queries") {
+            options.queries = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (name == "--brute-max") {
+            options.brute_max = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (name == "--seed") {
+            options.seed = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (name == "--threads") {
+            options.threads = std::strtoul(value.c_str(), nullptr, 10);
+            if (options.threads == 0) return false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--max-exp 3..7] [--format csv|json] [--out FILE]"
+                  << " [--queries N] [--brute-max N] [--seed N] [--threads N]\n";
+        return 1;
+    }
+    
+    std::vector<Row> rows;
+    for (char const* name: { "uniform", "clustered", "moving" }) {
+        std::size_t count = 1000;
+        for (int exp = 3; exp <= options.max_exp; ++exp, count *= 10) {
+            Workload workload = makeWorkload(name, count, options);
+            benchTree(workload, rows);
+            if (count <= options.brute_max) benchBruteForce(workload, rows);
+            benchParallelQuery(workload, options.threads, rows);
+            std::cerr << name << ' ' << count << " done\n";
+        }
+    }
+    
+    std::ofstream file;
+    if (!options.out.empty()) file.open(options.out);
+    std::ostream& out = options.out.empty() ? std::cout : file;
+    if (options.format == "json") {
+        writeJson(rows, out);
+    } else {
+        writeCsv(rows, out);
+    }
+    return 0;
+}
@@ -8,6 +8,7 @@
 #include <cassert>
 #include <memory>
 #include <cstring>
+#include <algorithm>
 #include "Vector.hpp"
 
 template<typename T>
@@ -52,6 +53,14 @@ class Box {
         return Vector2<T>(width, height);
     }
     
+    // Box of the same center with the size multiplied by factor
+    Box scaled(T factor) const {
+        T new_width = width * factor;
+        T new_height = height * factor;
+        return Box(left - (new_width - width) / 2, top - (new_height - height) / 2,
+                   new_width, new_height);
+    }
+    
     bool contains(const Box<T>& box) const {
         return left <= box.left && box.getRight() <= getRight() &&
                top <= box.top && box.getBottom() <= getBottom();
@@ -64,6 +73,27 @@ class Box {
         return !outside;
     }
     
+    // Squared distance from the point to the nearest point of the box,
+    // zero for a point inside
+    T distanceSquared(Vector2<T> const& point) const {
+        T dx = point.x < left ? left - point.x : (point.x > getRight() ? point.x - getRight() : T());
+        T dy = point.y < top ? top - point.y : (point.y > getBottom() ? point.y - getBottom() : T());
+        return dx * dx + dy * dy;
+    }
+    
+    // Slab test of the ray origin + t * direction, 0 <= t <= max_t, against
+    // the closed box. Gives t of the point where the ray enters the box,
+    // zero if the origin is inside. With a unit direction t is the distance.
+    bool rayEntry(Vector2<T> const& origin, Vector2<T> const& direction, T max_t, T& t) const {
+        T t_min = T(), t_max = max_t;
+        if (!clipSlab(origin.x, direction.x, left, getRight(), t_min, t_max) ||
+            !clipSlab(origin.y, direction.y, top, getBottom(), t_min, t_max)) {
+            return false;
+        }
+        t = t_min;
+        return true;
+    }
+    
     bool operator==(Box<T> const& other) const {
         return memcmp(this, &other, sizeof(Box<T>)) == 0;
     }
@@ -127,6 +157,30 @@ class Box {
         else return NEITHER_ONE_QUADRANT;
     }
     
+  private:
+    // Narrows [t_min, t_max] to the part of the ray between low and high
+    // on one axis, false if nothing is left
+    static bool clipSlab(T origin, T direction, T low, T high, T& t_min, T& t_max) {
+        if (direction < T() || direction > T()) {
+            T t_low = (low - origin) / direction;
+            T t_high = (high - origin) / direction;
+            if (t_low > t_high) std::swap(t_low, t_high);
+            t_min = std::max(t_min, t_low);
+            t_max = std::min(t_max, t_high);
+            return t_min <= t_max;
+        }
+        // Parallel to the slab
+        return low <= origin && origin <= high;
+    }
+    
 };
 
+// Box holding the values of a loose quadtree node with the quadrant cell:
+// the cell scaled by the std::ratio Looseness, the cell itself for 1
+template <class Looseness, class Real>
+Box<Real> looseBox(Box<Real> const& cell) {
+    if (Looseness::num == Looseness::den) return cell;
+    return cell.scaled(static_cast<Real>(Looseness::num) / static_cast<Real>(Looseness::den));
+}
+
 #endif //QUADTREE_BOX_HPP
@@ -0,0 +1,275 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_BOXARRAY_HPP
+#define QUADTREE_BOXARRAY_HPP
+
+#include <memory>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+#include "Box.hpp"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Read-only boxes in the layout of BoxArray, which may lie in memory
+// the view does not own, like the pages of a mapped file
+template <class Real>
+class BoxArrayView {
+  public:
+    using Box = ::Box<Real>;
+    
+  public:
+    BoxArrayView(Real const* lefts, Real const* tops, Real const* widths,
+                 Real const* heights, std::size_t size)
+    : m_lanes { lefts, tops, widths, heights }
+    , m_size(size)
+    { }
+    
+    std::size_t size() const {
+        return m_size;
+    }
+    
+    Box operator[](std::size_t i) const {
+        assert(i < m_size);
+        return Box(lefts()[i], tops()[i], widths()[i], heights()[i]);
+    }
+    
+    Real const* lefts() const { return m_lanes[0]; }
+    Real const* tops() const { return m_lanes[1]; }
+    Real const* widths() const { return m_lanes[2]; }
+    Real const* heights() const { return m_lanes[3]; }
+    
+    // Calls visitor(i) for every box i intersecting query_box, in order,
+    // while the visitor returns true. Returns false if it was stopped.
+    // Same predicate as query_box.intersects(box).
+    template <class Visitor>
+    bool forEachIntersecting(Box const& query_box, Visitor& visitor) const {
+        return forEachIntersecting(query_box, visitor, 0, m_size);
+    }
+    
+    // Same for the boxes first .. last - 1 only
+    template <class Visitor>
+    bool forEachIntersecting(Box const& query_box, Visitor& visitor,
+                             std::size_t first, std::size_t last) const {
+        assert(first <= last && last <= m_size);
+        std::size_t i = vectorPrefix(query_box, visitor, first, last);
+        if (i == npos) return false;
+        
+        Real q_left = query_box.left, q_right = query_box.getRight();
+        Real q_top = query_box.top, q_bottom = query_box.getBottom();
+        for (; i != last; ++i) {
+            bool intersects =
+                q_left < lefts()[i] + widths()[i] && q_right > lefts()[i] &&
+                q_top < tops()[i] + heights()[i] && q_bottom > tops()[i];
+            if (intersects && !visitor(i)) return false;
+        }
+        return true;
+    }
+    
+  private:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+    
+    // Generic Real: no vector kernel, everything is left to the scalar loop
+    template <class Visitor, class R = Real>
+    typename std::enable_if<!std::is_same<R, float>::value, std::size_t>::type
+    vectorPrefix(Box const&, Visitor&, std::size_t first, std::size_t) const {
+        return first;
+    }
+    
+    // Visits the boxes in blocks of the vector width, returns the index
+    // the scalar loop continues from, or npos if the visitor stopped
+    template <class Visitor, class R = Real>
+    typename std::enable_if<std::is_same<R, float>::value, std::size_t>::type
+    vectorPrefix(Box const& query_box, Visitor& visitor,
+                 std::size_t first, std::size_t last) const {
+        std::size_t i = first;
+        #if defined(__AVX__)
+        __m256 q_left = _mm256_set1_ps(query_box.left);
+        __m256 q_right = _mm256_set1_ps(query_box.getRight());
+        __m256 q_top = _mm256_set1_ps(query_box.top);
+        __m256 q_bottom = _mm256_set1_ps(query_box.getBottom());
+        for (; i + 8 <= last; i += 8) {
+            __m256 left = _mm256_loadu_ps(lefts() + i);
+            __m256 top = _mm256_loadu_ps(tops() + i);
+            __m256 right = _mm256_add_ps(left, _mm256_loadu_ps(widths() + i));
+            __m256 bottom = _mm256_add_ps(top, _mm256_loadu_ps(heights() + i));
+            __m256 x = _mm256_and_ps(
+                _mm256_cmp_ps(q_left, right, _CMP_LT_OQ),
+                _mm256_cmp_ps(q_right, left, _CMP_GT_OQ)
+            );
+            __m256 y = _mm256_and_ps(
+                _mm256_cmp_ps(q_top, bottom, _CMP_LT_OQ),
+                _mm256_cmp_ps(q_bottom, top, _CMP_GT_OQ)
+            );
+            if (!visitMask(_mm256_movemask_ps(_mm256_and_ps(x, y)), i, visitor)) return npos;
+        }
+        #elif defined(__SSE__) || defined(_M_X64)
+        __m128 q_left = _mm_set1_ps(query_box.left);
+        __m128 q_right = _mm_set1_ps(query_box.getRight());
+        __m128 q_top = _mm_set1_ps(query_box.top);
+        __m128 q_bottom = _mm_set1_ps(query_box.getBottom());
+        for (; i + 4 <= last; i += 4) {
+            __m128 left = _mm_loadu_ps(lefts() + i);
+            __m128 top = _mm_loadu_ps(tops() + i);
+            __m128 right = _mm_add_ps(left, _mm_loadu_ps(widths() + i));
+            __m128 bottom = _mm_add_ps(top, _mm_loadu_ps(heights() + i));
+            __m128 x = _mm_and_ps(_mm_cmplt_ps(q_left, right), _mm_cmpgt_ps(q_right, left));
+            __m128 y = _mm_and_ps(_mm_cmplt_ps(q_top, bottom), _mm_cmpgt_ps(q_bottom, top));
+            if (!visitMask(_mm_movemask_ps(_mm_and_ps(x, y)), i, visitor)) return npos;
+        }
+        #else
+        (void)query_box;
+        (void)visitor;
+        (void)last;
+        #endif
+        return i;
+    }
+    
+    template <class Visitor>
+    static bool visitMask(int mask, std::size_t first, Visitor& visitor) {
+        for (std::size_t i = first; mask != 0; ++i, mask >>= 1) {
+            if ((mask & 1) && !visitor(i)) return false;
+        }
+        return true;
+    }
+    
+  private:
+    Real const* m_lanes[4];
+    std::size_t m_size;
+};
+
+// Boxes in structure-of-arrays layout: lefts, tops, widths and heights
+// are separate lanes of one buffer, so many boxes are tested against
+// a query box by one vector instruction. The boxes are kept exactly
+// as given, right and bottom are computed the way Box computes them.
+template <class Real>
+class BoxArray {
+  public:
+    using Box = ::Box<Real>;
+    
+  public:
+    BoxArray() = default;
+    
+    BoxArray(BoxArray&& other) noexcept
+    : m_data(std::move(other.m_data))
+    , m_size(other.m_size)
+    , m_capacity(other.m_capacity)
+    {
+        other.m_size = other.m_capacity = 0;
+    }
+    
+    BoxArray& operator=(BoxArray&& other) noexcept {
+        m_data = std::move(other.m_data);
+        m_size = other.m_size;
+        m_capacity = other.m_capacity;
+        other.m_size = other.m_capacity = 0;
+        return *this;
+    }
+    
+    std::size_t size() const {
+        return m_size;
+    }
+    
+    bool empty() const {
+        return m_size == 0;
+    }
+    
+    std::size_t capacity() const {
+        return m_capacity;
+    }
+    
+    void reserve(std::size_t capacity) {
+        if (capacity > m_capacity) reallocate(static_cast<std::uint32_t>(capacity));
+    }
+    
+    void shrink_to_fit() {
+        if (m_size != m_capacity) reallocate(m_size);
+    }
+    
+    void clear() {
+        m_size = 0;
+    }
+    
+    void push_back(Box const& box) {
+        if (m_size == m_capacity) {
+            reallocate(std::max<std::uint32_t>(4, m_capacity * 2));
+        }
+        set(m_size++, box);
+    }
+    
+    // Moves the last box into the place of the removed one
+    void swapRemove(std::size_t i) {
+        assert(i < m_size);
+        --m_size;
+        for (int lane = 0; lane != 4; ++lane) {
+            this->lane(lane)[i] = this->lane(lane)[m_size];
+        }
+    }
+    
+    void set(std::size_t i, Box const& box) {
+        assert(i < m_capacity);
+        lane(0)[i] = box.left;
+        lane(1)[i] = box.top;
+        lane(2)[i] = box.width;
+        lane(3)[i] = box.height;
+    }
+    
+    Box operator[](std::size_t i) const {
+        assert(i < m_size);
+        return Box(lefts()[i], tops()[i], widths()[i], heights()[i]);
+    }
+    
+    Real const* lefts() const { return lane(0); }
+    Real const* tops() const { return lane(1); }
+    Real const* widths() const { return lane(2); }
+    Real const* heights() const { return lane(3); }
+    
+    // Calls visitor(i) for every box i intersecting query_box, in order,
+    // while the visitor returns true. Returns false if it was stopped.
+    // Same predicate as query_box.intersects(box).
+    template <class Visitor>
+    bool forEachIntersecting(Box const& query_box, Visitor& visitor) const {
+        return view().forEachIntersecting(query_box, visitor);
+    }
+    
+    // Same for the boxes first .. last - 1 only
+    template <class Visitor>
+    bool forEachIntersecting(Box const& query_box, Visitor& visitor,
+                             std::size_t first, std::size_t last) const {
+        return view().forEachIntersecting(query_box, visitor, first, last);
+    }
+    
+    BoxArrayView<Real> view() const {
+        return BoxArrayView<Real>(lefts(), tops(), widths(), heights(), m_size);
+    }
+    
+  private:
+    Real* lane(int i) {
+        return m_data.get() + static_cast<std::size_t>(i) * m_capacity;
+    }
+    
+    Real const* lane(int i) const {
+        return m_data.get() + static_cast<std::size_t>(i) * m_capacity;
+    }
+    
+    void reallocate(std::uint32_t capacity) {
+        std::unique_ptr<Real[]> data(capacity != 0 ? new Real[4 * std::size_t(capacity)] : nullptr);
+        for (int lane = 0; lane != 4; ++lane) {
+            std::copy(this->lane(lane), this->lane(lane) + m_size,
+                      data.get() + static_cast<std::size_t>(lane) * capacity);
+        }
+        m_data = std::move(data);
+        m_capacity = capacity;
+    }
+    
+  private:
+    std::unique_ptr<Real[]> m_data;
+    std::uint32_t m_size = 0;
+    std::uint32_t m_capacity = 0;
+};
+
+#endif // QUADTREE_BOXARRAY_HPP
@@ -0,0 +1,211 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_LINEARQUADTREE_HPP
+#define QUADTREE_LINEARQUADTREE_HPP
+
+#include <ratio>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include "QuadTreeBase.hpp"
+#include "BoxArray.hpp"
+#include "QuadTreeFile.hpp"
+
+// Node of LinearQuadTree, also the layout of the nodes in its file
+struct LinearQuadTreeNode {
+    std::uint32_t first_child;
+    std::uint32_t values_begin;
+    std::uint32_t values_end;
+};
+
+// Immutable pointerless QuadTree. Nodes lie in one array in depth-first
+// order of sibling blocks: the four children of a node are neighbours,
+// so a node keeps only the index of the first one. Values of all the
+// nodes are packed in one SoA array of boxes and one array of payloads,
+// a node owns the range values_begin .. values_end - 1 of them.
+// Looseness is the one of the tree it is built from, see QuadTreeLimits.
+template<class T, class Real = float, class Looseness = std::ratio<1>>
+class LinearQuadTree {
+  public:
+    using Value = typename ValueInBox<T, Real>::Value;
+    using ValPtr = typename Value::Ptr;
+    using Box = typename Value::Box;
+    using Index = std::uint32_t;
+    using LinearNode = LinearQuadTreeNode;
+    static constexpr Index null = 0xFFFFFFFFu;
+    
+  public:
+    explicit LinearQuadTree(Box tree_box = Box())
+    : m_tree_box(tree_box)
+    { }
+    
+    // Lays out the tree of the root node. NodeT gives isLeaf(), values(),
+    // boxes() and child(pool, i), like Node of QuadTree does.
+    template <class PoolT, class NodeT>
+    static LinearQuadTree build(Box const& tree_box, PoolT const& pool,
+                                NodeT const& root, std::size_t node_count,
+                                std::size_t value_count) {
+        LinearQuadTree tree(tree_box);
+        tree.m_nodes.reserve(node_count);
+        tree.m_boxes.reserve(value_count);
+        tree.m_values.reserve(value_count);
+        tree.m_nodes.push_back(LinearNode { null, 0, 0 });
+        tree.layout(pool, root, 0);
+        return tree;
+    }
+    
+    std::vector<ValPtr> query(Box const& query_box) const {
+        std::vector<ValPtr> match_values;
+        queryIndices(query_box, [this, &match_values] (std::size_t i) {
+            match_values.push_back(m_values[i]);
+            return true;
+        });
+        return match_values;
+    }
+    
+    // Calls callback(Value const&) for the values intersecting query_box
+    // until it returns false. Returns false if the callback stopped the query.
+    template <class Callback>
+    bool queryVisit(Box const& query_box, Callback callback) const {
+        return queryIndices(query_box, [this, &callback] (std::size_t i) {
+            return callback(static_cast<Value const&>(*m_values[i]));
+        });
+    }
+    
+    // Same with the index of the value in the packed arrays
+    template <class Callback>
+    bool queryIndices(Box const& query_box, Callback callback) const {
+        if (m_nodes.empty() || !query_box.intersects(m_tree_box)) return true;
+        return visit(0, m_tree_box, query_box, callback);
+    }
+    
+    Box const& treeBox() const {
+        return m_tree_box;
+    }
+    
+    std::vector<LinearNode> const& nodes() const {
+        return m_nodes;
+    }
+    
+    BoxArray<Real> const& boxes() const {
+        return m_boxes;
+    }
+    
+    std::vector<ValPtr> const& values() const {
+        return m_values;
+    }
+    
+    // Writes the tree to a file for MappedQuadTree, see QuadTreeFile.hpp.
+    // payload_of(Value const&) gives the trivially copyable payload stored
+    // for a value in place of it. Returns false if the file was not written.
+    template <class PayloadOf>
+    bool save(std::string const& path, PayloadOf payload_of) const {
+        using Payload = typename std::decay<decltype(payload_of(std::declval<Value const&>()))>::type;
+        static_assert(std::is_trivially_copyable<Payload>::value, "Payloads are stored as bytes");
+        
+        QuadTreeFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, QuadTreeFileHeader::expectedMagic(), sizeof(header.magic));
+        header.version = QuadTreeFileVersion;
+        header.byte_order = QuadTreeFileByteOrder;
+        header.real_size = sizeof(Real);
+        header.payload_size = sizeof(Payload);
+        header.looseness_num = Looseness::num;
+        header.looseness_den = Looseness::den;
+        header.tree_box[0] = m_tree_box.left;
+        header.tree_box[1] = m_tree_box.top;
+        header.tree_box[2] = m_tree_box.width;
+        header.tree_box[3] = m_tree_box.height;
+        header.node_count = m_nodes.size();
+        header.value_count = m_values.size();
+        header.nodes_offset = QuadTreeFileHeader::aligned(sizeof(header));
+        header.boxes_offset = QuadTreeFileHeader::aligned(
+            header.nodes_offset + m_nodes.size() * sizeof(LinearNode)
+        );
+        header.payloads_offset = QuadTreeFileHeader::aligned(
+            header.boxes_offset + 4 * m_values.size() * sizeof(Real)
+        );
+        header.file_size = header.payloads_offset + m_values.size() * sizeof(Payload);
+        
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        std::uint64_t position = 0;
+        auto write = [&file, &position] (void const* data, std::size_t size) {
+            file.write(static_cast<char const*>(data), static_cast<std::streamsize>(size));
+            position += size;
+        };
+        auto padTo = [&file, &position] (std::uint64_t offset) {
+            for (; position != offset; ++position) file.put(0);
+        };
+        
+        write(&header, sizeof(header));
+        padTo(header.nodes_offset);
+        write(m_nodes.data(), m_nodes.size() * sizeof(LinearNode));
+        padTo(header.boxes_offset);
+        Real const* lanes[] = { m_boxes.lefts(), m_boxes.tops(), m_boxes.widths(), m_boxes.heights() };
+        for (Real const* lane: lanes) write(lane, m_values.size() * sizeof(Real));
+        padTo(header.payloads_offset);
+        for (ValPtr const& value: m_values) {
+            Payload payload = payload_of(static_cast<Value const&>(*value));
+            write(&payload, sizeof(payload));
+        }
+        file.close();
+        return static_cast<bool>(file);
+    }
+    
+  private:
+    template <class PoolT, class NodeT>
+    void layout(PoolT const& pool, NodeT const& node, Index index) {
+        m_nodes[index].values_begin = static_cast<Index>(m_values.size());
+        for (std::size_t k = 0; k != node.values().size(); ++k) {
+            m_values.push_back(node.values()[k]);
+            m_boxes.push_back(node.boxes()[k]);
+        }
+        m_nodes[index].values_end = static_cast<Index>(m_values.size());
+        if (node.isLeaf()) return;
+        
+        Index first_child = static_cast<Index>(m_nodes.size());
+        m_nodes[index].first_child = first_child;
+        m_nodes.resize(m_nodes.size() + 4, LinearNode { null, 0, 0 });
+        for (int i = 0; i != 4; ++i) {
+            layout(pool, node.child(pool, i), first_child + static_cast<Index>(i));
+        }
+    }
+    
+    template <class Callback>
+    bool visit(Index index, Box const& node_box, Box const& query_box,
+               Callback& callback) const {
+        assert(query_box.intersects(looseBox<Looseness>(node_box)));
+        LinearNode const& node = m_nodes[index];
+        if (!m_boxes.forEachIntersecting(query_box, callback,
+                                         node.values_begin, node.values_end)) {
+            return false;
+        }
+        
+        if (node.first_child != null) {
+            for (int i = 0; i != 4; ++i) {
+                Box child_box = node_box.quadrantByIndex(i);
+                if (query_box.intersects(looseBox<Looseness>(child_box)) &&
+                    !visit(node.first_child + static_cast<Index>(i), child_box, query_box, callback)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    
+  private:
+    Box m_tree_box;
+    std::vector<LinearNode> m_nodes;
+    BoxArray<Real> m_boxes;
+    std::vector<ValPtr> m_values;
+};
+
+template<class T, class Real, class Looseness>
+constexpr typename LinearQuadTree<T, Real, Looseness>::Index LinearQuadTree<T, Real, Looseness>::null;
+
+#endif // QUADTREE_LINEARQUADTREE_HPP
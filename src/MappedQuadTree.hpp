@@ -0,0 +1,184 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_MAPPEDQUADTREE_HPP
+#define QUADTREE_MAPPEDQUADTREE_HPP
+
+#include <ratio>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "BoxArray.hpp"
+#include "LinearQuadTree.hpp"
+#include "QuadTreeFile.hpp"
+
+// Read-only QuadTree over a file saved by QuadTree::save() or
+// LinearQuadTree::save(). The file is mapped, not read: queries run over
+// its pages as they are, so opening costs no deserialization and no
+// allocation per node, and the processes opening one file share its pages.
+// Payload, Real and Looseness must be the ones the file was saved with,
+// otherwise the tree stays closed, like it does for a missing, truncated
+// or other version file. Opening reads the nodes once to check their links,
+// a damaged file stays closed too instead of sending queries out of it.
+template <class Payload, class Real = float, class Looseness = std::ratio<1>>
+class MappedQuadTree {
+  public:
+    using Box = ::Box<Real>;
+    using Index = std::uint32_t;
+    static constexpr Index null = 0xFFFFFFFFu;
+    
+    static_assert(std::is_trivially_copyable<Payload>::value, "Payloads are stored as bytes");
+    
+  public:
+    explicit MappedQuadTree(std::string const& path)
+    : m_file(path)
+    {
+        QuadTreeFileHeader header;
+        if (m_file.size() < sizeof(header)) return;
+        std::memcpy(&header, m_file.data(), sizeof(header));
+        if (!matches(header)) return;
+        
+        char const* data = m_file.data();
+        auto nodes = reinterpret_cast<LinearQuadTreeNode const*>(data + header.nodes_offset);
+        std::size_t node_count = static_cast<std::size_t>(header.node_count);
+        std::size_t count = static_cast<std::size_t>(header.value_count);
+        if (!validNodes(nodes, node_count, count)) return;
+        
+        m_tree_box = Box(static_cast<Real>(header.tree_box[0]), static_cast<Real>(header.tree_box[1]),
+                         static_cast<Real>(header.tree_box[2]), static_cast<Real>(header.tree_box[3]));
+        m_nodes = nodes;
+        m_node_count = node_count;
+        Real const* lanes = reinterpret_cast<Real const*>(data + header.boxes_offset);
+        m_boxes = BoxArrayView<Real>(lanes, lanes + count, lanes + 2 * count, lanes + 3 * count, count);
+        m_payloads = reinterpret_cast<Payload const*>(data + header.payloads_offset);
+    }
+    
+    MappedQuadTree(MappedQuadTree const&) = delete;
+    MappedQuadTree& operator=(MappedQuadTree const&) = delete;
+    
+    bool isOpen() const {
+        return m_nodes != nullptr;
+    }
+    
+    // Count of values in the tree
+    std::size_t size() const {
+        return m_boxes.size();
+    }
+    
+    Box const& treeBox() const {
+        return m_tree_box;
+    }
+    
+    Payload const& payload(std::size_t i) const {
+        assert(i < size());
+        return m_payloads[i];
+    }
+    
+    Box box(std::size_t i) const {
+        return m_boxes[i];
+    }
+    
+    std::vector<Payload> query(Box const& query_box) const {
+        std::vector<Payload> match_payloads;
+        queryIndices(query_box, [this, &match_payloads] (std::size_t i) {
+            match_payloads.push_back(m_payloads[i]);
+            return true;
+        });
+        return match_payloads;
+    }
+    
+    // Calls callback(Payload const&) for the values intersecting query_box
+    // until it returns false. Returns false if the callback stopped the query.
+    template <class Callback>
+    bool queryVisit(Box const& query_box, Callback callback) const {
+        return queryIndices(query_box, [this, &callback] (std::size_t i) {
+            return callback(m_payloads[i]);
+        });
+    }
+    
+    // Same with the index of the value, see payload() and box()
+    template <class Callback>
+    bool queryIndices(Box const& query_box, Callback callback) const {
+        if (!isOpen() || !query_box.intersects(m_tree_box)) return true;
+        return visit(0, m_tree_box, query_box, callback);
+    }
+    
+  private:
+    bool matches(QuadTreeFileHeader const& header) const {
+        bool same_format =
+            std::memcmp(header.magic, QuadTreeFileHeader::expectedMagic(), sizeof(header.magic)) == 0 &&
+            header.version == QuadTreeFileVersion &&
+            header.byte_order == QuadTreeFileByteOrder &&
+            header.real_size == sizeof(Real) &&
+            header.payload_size == sizeof(Payload) &&
+            header.looseness_num == Looseness::num &&
+            header.looseness_den == Looseness::den;
+        if (!same_format || header.file_size > m_file.size() || header.node_count == 0) return false;
+        
+        // Every section lies inside the file at an offset aligned for its items
+        std::uint64_t nodes_end = header.nodes_offset + header.node_count * sizeof(LinearQuadTreeNode);
+        std::uint64_t boxes_end = header.boxes_offset + 4 * header.value_count * sizeof(Real);
+        std::uint64_t payloads_end = header.payloads_offset + header.value_count * sizeof(Payload);
+        return header.nodes_offset % QuadTreeFileAlignment == 0 &&
+               header.boxes_offset % QuadTreeFileAlignment == 0 &&
+               header.payloads_offset % QuadTreeFileAlignment == 0 &&
+               nodes_end <= header.boxes_offset && boxes_end <= header.payloads_offset &&
+               payloads_end <= header.file_size;
+    }
+    
+    // Every value range lies in the values and every block of children in
+    // the nodes, after its parent like LinearQuadTree lays them out: visit()
+    // stays inside the file and ends
+    static bool validNodes(LinearQuadTreeNode const* nodes, std::size_t node_count,
+                           std::size_t value_count) {
+        for (std::size_t index = 0; index != node_count; ++index) {
+            LinearQuadTreeNode const& node = nodes[index];
+            if (node.values_begin > node.values_end || node.values_end > value_count) return false;
+            if (node.first_child != null &&
+                (node.first_child <= index || std::size_t(node.first_child) + 3 >= node_count)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    // Same walk as LinearQuadTree::visit()
+    template <class Callback>
+    bool visit(Index index, Box const& node_box, Box const& query_box,
+               Callback& callback) const {
+        assert(index < m_node_count);
+        LinearQuadTreeNode const& node = m_nodes[index];
+        if (!m_boxes.forEachIntersecting(query_box, callback,
+                                         node.values_begin, node.values_end)) {
+            return false;
+        }
+        
+        if (node.first_child != null) {
+            for (int i = 0; i != 4; ++i) {
+                Box child_box = node_box.quadrantByIndex(i);
+                if (query_box.intersects(looseBox<Looseness>(child_box)) &&
+                    !visit(node.first_child + static_cast<Index>(i), child_box, query_box, callback)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    
+  private:
+    MappedFile m_file;
+    Box m_tree_box;
+    // Null while the tree is closed
+    LinearQuadTreeNode const* m_nodes = nullptr;
+    std::size_t m_node_count = 0;
+    BoxArrayView<Real> m_boxes { nullptr, nullptr, nullptr, nullptr, 0 };
+    Payload const* m_payloads = nullptr;
+};
+
+template <class Payload, class Real, class Looseness>
+constexpr typename MappedQuadTree<Payload, Real, Looseness>::Index MappedQuadTree<Payload, Real, Looseness>::null;
+
+#endif // QUADTREE_MAPPEDQUADTREE_HPP
@@ -0,0 +1,136 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_NODEPOOL_HPP
+#define QUADTREE_NODEPOOL_HPP
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cassert>
+#include <cstdint>
+
+// Slab of tree nodes addressed by 32-bit indices. Nodes are allocated
+// in blocks of four siblings lying next to each other, so a parent keeps
+// only the index of its first child. Freed blocks go to a free list and
+// are reused before the slab grows.
+//
+// Chunk k holds FirstChunkSize * 2^k nodes. Chunks never move, so node
+// references stay valid while the pool grows, also when other threads
+// allocate: allocation is serialized, reading a node is not.
+template <class NodeT>
+class NodePool {
+  public:
+    using Index = std::uint32_t;
+    static constexpr Index null = 0xFFFFFFFFu;
+    static constexpr Index BlockSize = 4;
+    
+  public:
+    NodePool() = default;
+    NodePool(NodePool const&) = delete;
+    NodePool& operator=(NodePool const&) = delete;
+    
+    NodeT& operator[](Index i) {
+        return locate(i);
+    }
+    
+    NodeT const& operator[](Index i) const {
+        return const_cast<NodePool*>(this)->locate(i);
+    }
+    
+    // Index of the first node of four default constructed ones.
+    // Safe to call from several threads at once.
+    Index allocateBlock() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_free_blocks.empty()) {
+            Index first = m_free_blocks.back();
+            m_free_blocks.pop_back();
+            return first;
+        }
+        
+        Index first = m_size.load(std::memory_order_relaxed);
+        std::size_t chunk = chunkOf(first);
+        assert(chunk < m_chunks.size() && "Node pool is exhausted");
+        if (!m_chunks[chunk]) {
+            m_chunks[chunk].reset(new NodeT[chunkSize(chunk)]);
+        }
+        m_size.store(first + BlockSize, std::memory_order_relaxed);
+        return first;
+    }
+    
+    void freeBlock(Index first) {
+        assert(first % BlockSize == 0 && first < m_size.load(std::memory_order_relaxed));
+        for (Index i = first; i != first + BlockSize; ++i) {
+            locate(i) = NodeT();
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free_blocks.push_back(first);
+    }
+    
+    // Drops every node, the memory is kept for reuse
+    void clear() {
+        for (Index i = 0; i != m_size.load(std::memory_order_relaxed); ++i) {
+            locate(i) = NodeT();
+        }
+        m_free_blocks.clear();
+        m_size.store(0, std::memory_order_relaxed);
+    }
+    
+    // Nodes in use, free blocks excluded
+    std::size_t size() const {
+        return m_size.load(std::memory_order_relaxed) - m_free_blocks.size() * BlockSize;
+    }
+    
+    std::size_t capacity() const {
+        std::size_t nodes = 0;
+        for (std::size_t chunk = 0; chunk != m_chunks.size() && m_chunks[chunk]; ++chunk) {
+            nodes += chunkSize(chunk);
+        }
+        return nodes;
+    }
+    
+  private:
+    static constexpr std::size_t FirstChunkSize = 256;
+    
+    static std::size_t chunkSize(std::size_t chunk) {
+        return FirstChunkSize << chunk;
+    }
+    
+    // Chunk k starts at FirstChunkSize * (2^k - 1)
+    static std::size_t chunkOf(Index i) {
+        std::size_t blocks = i / FirstChunkSize + 1;
+        std::size_t chunk = 0;
+        #if defined(__GNUC__)
+        chunk = sizeof(unsigned long long) * 8 - 1 -
+                static_cast<std::size_t>(__builtin_clzll(blocks));
+        #else
+        while (blocks >>= 1) ++chunk;
+        #endif
+        return chunk;
+    }
+    
+    NodeT& locate(Index i) {
+        assert(i < m_size.load(std::memory_order_relaxed));
+        std::size_t chunk = chunkOf(i);
+        std::size_t offset = i - FirstChunkSize * ((std::size_t(1) << chunk) - 1);
+        return m_chunks[chunk][offset];
+    }
+    
+  private:
+    // 2^32 indices need at most 24 chunks
+    std::array<std::unique_ptr<NodeT[]>, 25> m_chunks;
+    std::vector<Index> m_free_blocks;
+    std::atomic<Index> m_size { 0 };
+    std::mutex m_mutex;
+};
+
+template <class NodeT>
+constexpr typename NodePool<NodeT>::Index NodePool<NodeT>::null;
+
+template <class NodeT>
+constexpr typename NodePool<NodeT>::Index NodePool<NodeT>::BlockSize;
+
+#endif // QUADTREE_NODEPOOL_HPP
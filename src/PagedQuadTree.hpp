@@ -0,0 +1,488 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_PAGEDQUADTREE_HPP
+#define QUADTREE_PAGEDQUADTREE_HPP
+
+#include <list>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <type_traits>
+#include <unordered_map>
+#include "Box.hpp"
+#include "BoxArray.hpp"
+
+// Node of PagedQuadTree, one page of its file. Values that do not fit
+// the page go to the next pages of the node, chained by next.
+// The boxes are kept in lanes like BoxArray keeps them.
+template <class Payload, class Real, std::size_t PageSize>
+struct TreePage {
+    using Index = std::uint32_t;
+    using Box = ::Box<Real>;
+    static constexpr Index null = 0xFFFFFFFFu;
+    // Seven indices, padded for the alignment of the lanes and payloads
+    static constexpr std::size_t HeaderSize = 32;
+    static constexpr std::size_t capacity = (PageSize - HeaderSize) / (4 * sizeof(Real) + sizeof(Payload));
+    
+    Index count;
+    Index next;
+    Index depth;
+    // Null for a leaf
+    Index children[4];
+    Real lanes[4][capacity];
+    Payload payloads[capacity];
+    
+    bool isLeaf() const {
+        return children[0] == null;
+    }
+    
+    bool isFull() const {
+        return count == capacity;
+    }
+    
+    BoxArrayView<Real> boxes() const {
+        return BoxArrayView<Real>(lanes[0], lanes[1], lanes[2], lanes[3], count);
+    }
+    
+    Box box(std::size_t i) const {
+        return Box(lanes[0][i], lanes[1][i], lanes[2][i], lanes[3][i]);
+    }
+    
+    void set(std::size_t i, Box const& box, Payload const& payload) {
+        lanes[0][i] = box.left;
+        lanes[1][i] = box.top;
+        lanes[2][i] = box.width;
+        lanes[3][i] = box.height;
+        payloads[i] = payload;
+    }
+    
+    void append(Box const& box, Payload const& payload) {
+        assert(!isFull());
+        set(count++, box, payload);
+    }
+    
+    void reset(Index node_depth) {
+        count = 0;
+        next = null;
+        depth = node_depth;
+        std::fill(children, children + 4, null);
+    }
+};
+
+template <class Payload, class Real, std::size_t PageSize>
+constexpr typename TreePage<Payload, Real, PageSize>::Index TreePage<Payload, Real, PageSize>::null;
+
+template <class Payload, class Real, std::size_t PageSize>
+constexpr std::size_t TreePage<Payload, Real, PageSize>::capacity;
+
+// Work of the page cache of a PagedQuadTree
+struct PagedQuadTreeStats {
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    // Dirty pages written back to the file
+    std::size_t writes = 0;
+    // Pages of the upper levels, always in memory
+    std::size_t resident_pages = 0;
+    std::size_t cached_pages = 0;
+};
+
+// QuadTree of fixed size payloads for datasets larger than the memory.
+// Every node is a page of a scratch file. The pages of the nodes above
+// resident_depth stay in memory, the deeper ones are loaded on demand by
+// an LRU cache holding as many pages as the memory budget leaves after
+// the resident ones. Only the resident pages alone may exceed the budget.
+// Changed pages are written back when they are evicted.
+// A node is split when its first page is full, a node at MaxDepth and
+// the values straddling the axes of a node take further pages instead.
+// The file is deleted with the tree. Queries change the cache, so even
+// they must not run concurrently.
+// A page file that cannot be created, read or written puts the tree in
+// a failed state, see failed(): a page that is not read, or is read back
+// with links out of the tree, is taken for an empty leaf, and a page that
+// is not written is lost.
+template <class Payload, class Real = float, std::size_t PageSize = 4096, std::size_t MaxDepth = 12>
+class PagedQuadTree {
+  public:
+    using Box = ::Box<Real>;
+    using Page = TreePage<Payload, Real, PageSize>;
+    using Index = typename Page::Index;
+    
+    static_assert(std::is_trivially_copyable<Payload>::value, "Payloads are stored as bytes");
+    static_assert(sizeof(Page) <= PageSize && Page::capacity >= 4, "Page is too small for the payload");
+    
+  public:
+    PagedQuadTree(Box tree_box, std::string const& path, std::size_t memory_budget,
+                  std::size_t resident_depth = 2)
+    : m_tree_box(tree_box)
+    , m_path(path)
+    , m_file(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc)
+    , m_budget_pages(std::max<std::size_t>(1, memory_budget / PageSize))
+    , m_resident_depth(resident_depth)
+    {
+        m_failed = !m_file;
+        // The root is the page 0
+        allocatePage(0);
+    }
+    
+    PagedQuadTree(PagedQuadTree const&) = delete;
+    PagedQuadTree& operator=(PagedQuadTree const&) = delete;
+    
+    ~PagedQuadTree() {
+        m_file.close();
+        std::remove(m_path.c_str());
+    }
+    
+    void add(Box const& box, Payload const& payload) {
+        assert(m_tree_box.contains(box));
+        Index id = 0;
+        Box cell = m_tree_box;
+        while (true) {
+            Page& node = page(id);
+            if (!node.isLeaf()) {
+                typename Box::Quadrants i = cell.quadrantIndex(box);
+                if (i == Box::NEITHER_ONE_QUADRANT) break;
+                id = node.children[i];
+                cell = cell.quadrantByIndex(i);
+            } else if (node.isFull() && node.depth < MaxDepth) {
+                split(id, cell);
+            } else {
+                break;
+            }
+        }
+        appendToChain(id, box, payload);
+        ++m_size;
+    }
+    
+    // Removes a value with the same box and payload bytes,
+    // then merges the emptied ancestors
+    void remove(Box const& box, Payload const& payload) {
+        std::array<Index, MaxDepth + 1> path;
+        std::size_t depth = 0;
+        path[0] = 0;
+        Box cell = m_tree_box;
+        while (!removeFromChain(path[depth], box, payload)) {
+            Page const& node = page(path[depth]);
+            assert(!node.isLeaf() && "Trying to remove a value that is not present in the tree");
+            typename Box::Quadrants i = cell.quadrantIndex(box);
+            assert(i != Box::NEITHER_ONE_QUADRANT);
+            path[depth + 1] = node.children[i];
+            cell = cell.quadrantByIndex(i);
+            ++depth;
+        }
+        --m_size;
+        
+        // Merges from the node of the value, or from its parent for a leaf
+        if (page(path[depth]).isLeaf()) {
+            if (depth == 0) return;
+            --depth;
+        }
+        while (tryMerge(path[depth]) && depth != 0) --depth;
+    }
+    
+    // Count of values in the tree
+    std::size_t size() const {
+        return m_size;
+    }
+    
+    std::vector<Payload> query(Box const& query_box) const {
+        std::vector<Payload> match_payloads;
+        queryVisit(query_box, [&match_payloads] (Payload const& payload) {
+            match_payloads.push_back(payload);
+            return true;
+        });
+        return match_payloads;
+    }
+    
+    // Calls callback(Payload const&) for the values intersecting query_box
+    // until it returns false. Returns false if the callback stopped the query.
+    // The callback must not change the tree.
+    template <class Callback>
+    bool queryVisit(Box const& query_box, Callback callback) const {
+        if (!query_box.intersects(m_tree_box)) return true;
+        return visit(0, m_tree_box, query_box, callback);
+    }
+    
+    // True once the page file failed, the tree may have lost values since
+    bool failed() const {
+        return m_failed;
+    }
+    
+    PagedQuadTreeStats stats() const {
+        PagedQuadTreeStats stats = m_stats;
+        stats.resident_pages = m_resident.size();
+        stats.cached_pages = m_lookup.size();
+        return stats;
+    }
+    
+  private:
+    // Cached page, the most recently used first
+    struct Frame {
+        Index id;
+        bool dirty;
+        std::unique_ptr<Page> page;
+    };
+    using Frames = std::list<Frame>;
+    
+    // The page stays valid until the next call of page(),
+    // which may evict it
+    Page& page(Index id) const {
+        auto resident = m_resident.find(id);
+        if (resident != m_resident.end()) {
+            ++m_stats.hits;
+            return *resident->second;
+        }
+        
+        auto found = m_lookup.find(id);
+        if (found != m_lookup.end()) {
+            ++m_stats.hits;
+            m_frames.splice(m_frames.begin(), m_frames, found->second);
+            return *found->second->page;
+        }
+        
+        ++m_stats.misses;
+        std::unique_ptr<Page> loaded = takeFrame();
+        m_file.seekg(static_cast<std::streamoff>(id) * static_cast<std::streamoff>(PageSize));
+        m_file.read(reinterpret_cast<char*>(loaded.get()), sizeof(Page));
+        if (!m_file || !linksPages(*loaded)) {
+            // An empty leaf, walks end there
+            fail();
+            loaded->reset(static_cast<Index>(MaxDepth));
+        }
+        return cache(id, std::move(loaded), false);
+    }
+    
+    // Whether the links of a page read back lead to pages of the tree.
+    // No page links to the root, so a hole the file left of zeros fails.
+    bool linksPages(Page const& loaded) const {
+        auto valid = [this] (Index id) {
+            return id == Page::null || (id != 0 && id < m_page_count);
+        };
+        return valid(loaded.next) && std::all_of(loaded.children, loaded.children + 4, valid);
+    }
+    
+    // Memory of a page, evicting the least recently used ones
+    // while the budget is spent
+    std::unique_ptr<Page> takeFrame() const {
+        std::unique_ptr<Page> memory;
+        while (!m_frames.empty() && m_resident.size() + m_frames.size() >= m_budget_pages) {
+            memory = evict();
+        }
+        return memory ? std::move(memory) : std::unique_ptr<Page>(new Page());
+    }
+    
+    // Drops the least recently used page, writing it back if it changed
+    std::unique_ptr<Page> evict() const {
+        Frame& victim = m_frames.back();
+        if (victim.dirty) {
+            write(victim.id, *victim.page);
+        }
+        std::unique_ptr<Page> memory = std::move(victim.page);
+        m_lookup.erase(victim.id);
+        m_frames.pop_back();
+        return memory;
+    }
+    
+    Page& cache(Index id, std::unique_ptr<Page> memory, bool dirty) const {
+        m_frames.push_front(Frame { id, dirty, std::move(memory) });
+        m_lookup[id] = m_frames.begin();
+        return *m_frames.front().page;
+    }
+    
+    void write(Index id, Page const& page) const {
+        m_file.seekp(static_cast<std::streamoff>(id) * static_cast<std::streamoff>(PageSize));
+        m_file.write(reinterpret_cast<char const*>(&page), sizeof(Page));
+        if (!m_file) {
+            fail();
+            return;
+        }
+        ++m_stats.writes;
+    }
+    
+    // The stream is cleared, the other pages may still be read and written
+    void fail() const {
+        m_failed = true;
+        m_file.clear();
+    }
+    
+    // Same for a page about to be changed: it is written back when evicted
+    Page& writablePage(Index id) {
+        Page& loaded = page(id);
+        auto found = m_lookup.find(id);
+        if (found != m_lookup.end()) found->second->dirty = true;
+        return loaded;
+    }
+    
+    // Empty page of a node at the depth
+    Index allocatePage(std::size_t depth) {
+        Index id = m_page_count;
+        if (!m_free_pages.empty()) {
+            id = m_free_pages.back();
+            m_free_pages.pop_back();
+        } else {
+            ++m_page_count;
+        }
+        
+        if (depth < m_resident_depth) {
+            std::unique_ptr<Page>& memory = m_resident[id];
+            memory.reset(new Page());
+            memory->reset(static_cast<Index>(depth));
+            // The cache gives way to the resident pages
+            while (!m_frames.empty() && m_resident.size() + m_frames.size() > m_budget_pages) {
+                evict();
+            }
+        } else {
+            cache(id, takeFrame(), true).reset(static_cast<Index>(depth));
+        }
+        return id;
+    }
+    
+    // The content of the page is dropped, it is never written back
+    void freePage(Index id) {
+        auto found = m_lookup.find(id);
+        if (found != m_lookup.end()) {
+            m_frames.erase(found->second);
+            m_lookup.erase(found);
+        }
+        m_resident.erase(id);
+        m_free_pages.push_back(id);
+    }
+    
+    void appendToChain(Index id, Box const& box, Payload const& payload) {
+        while (page(id).isFull()) {
+            Index next = page(id).next;
+            if (next == Page::null) {
+                next = allocatePage(page(id).depth);
+                writablePage(id).next = next;
+            }
+            id = next;
+        }
+        writablePage(id).append(box, payload);
+    }
+    
+    // Moves the values of a full leaf to new children
+    // where they fit in a quadrant
+    void split(Index id, Box const& cell) {
+        Page values = page(id);
+        assert(values.isLeaf() && values.next == Page::null);
+        Index children[4];
+        for (Index& child: children) child = allocatePage(values.depth + 1);
+        
+        Page& node = writablePage(id);
+        node.count = 0;
+        std::copy(children, children + 4, node.children);
+        for (std::size_t k = 0; k != values.count; ++k) {
+            Box box = values.box(k);
+            typename Box::Quadrants i = cell.quadrantIndex(box);
+            appendToChain(i != Box::NEITHER_ONE_QUADRANT ? children[i] : id, box, values.payloads[k]);
+        }
+    }
+    
+    // Returns true if the value was found among the values of the node.
+    // The last value of the chain takes its place.
+    bool removeFromChain(Index id, Box const& box, Payload const& payload) {
+        Index found = Page::null;
+        std::size_t slot = 0;
+        Index last = id, before_last = Page::null;
+        for (Index current = id; current != Page::null; current = page(current).next) {
+            Page const& chain_page = page(current);
+            for (std::size_t k = 0; found == Page::null && k != chain_page.count; ++k) {
+                Box stored = chain_page.box(k);
+                if (std::memcmp(&stored, &box, sizeof(Box)) == 0 &&
+                    std::memcmp(&chain_page.payloads[k], &payload, sizeof(Payload)) == 0) {
+                    found = current;
+                    slot = k;
+                }
+            }
+            if (current != id) before_last = last;
+            last = current;
+        }
+        if (found == Page::null) return false;
+        
+        Page moved = page(last);
+        writablePage(found).set(slot, moved.box(moved.count - 1), moved.payloads[moved.count - 1]);
+        Page& last_page = writablePage(last);
+        --last_page.count;
+        if (last_page.count == 0 && last != id) {
+            freePage(last);
+            writablePage(before_last).next = Page::null;
+        }
+        return true;
+    }
+    
+    // Returns true if the leaf children were merged into the node
+    bool tryMerge(Index id) {
+        Page const& node = page(id);
+        if (node.isLeaf() || node.next != Page::null) return false;
+        Index children[4];
+        std::copy(node.children, node.children + 4, children);
+        std::size_t count = node.count;
+        for (Index child: children) {
+            Page const& child_page = page(child);
+            if (!child_page.isLeaf() || child_page.next != Page::null) return false;
+            count += child_page.count;
+        }
+        if (count > Page::capacity) return false;
+        
+        for (Index child: children) {
+            Page values = page(child);
+            for (std::size_t k = 0; k != values.count; ++k) {
+                writablePage(id).append(values.box(k), values.payloads[k]);
+            }
+            freePage(child);
+        }
+        Page& merged = writablePage(id);
+        std::fill(merged.children, merged.children + 4, Page::null);
+        return true;
+    }
+    
+    template <class Callback>
+    bool visit(Index id, Box const& cell, Box const& query_box, Callback& callback) const {
+        Index children[4];
+        std::copy(page(id).children, page(id).children + 4, children);
+        for (Index current = id; current != Page::null; ) {
+            Page const& chain_page = page(current);
+            auto match = [&chain_page, &callback] (std::size_t i) {
+                return callback(chain_page.payloads[i]);
+            };
+            if (!chain_page.boxes().forEachIntersecting(query_box, match)) return false;
+            current = chain_page.next;
+        }
+        
+        if (children[0] != Page::null) {
+            for (int i = 0; i != 4; ++i) {
+                Box child_box = cell.quadrantByIndex(i);
+                if (query_box.intersects(child_box) &&
+                    !visit(children[i], child_box, query_box, callback)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    
+  private:
+    Box m_tree_box;
+    std::string m_path;
+    mutable std::fstream m_file;
+    std::size_t m_budget_pages;
+    std::size_t m_resident_depth;
+    std::size_t m_size = 0;
+    Index m_page_count = 0;
+    std::vector<Index> m_free_pages;
+    // Pages of the nodes above the resident depth
+    std::unordered_map<Index, std::unique_ptr<Page>> m_resident;
+    mutable Frames m_frames;
+    mutable std::unordered_map<Index, typename Frames::iterator> m_lookup;
+    mutable PagedQuadTreeStats m_stats;
+    mutable bool m_failed = false;
+};
+
+#endif // QUADTREE_PAGEDQUADTREE_HPP
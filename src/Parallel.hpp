@@ -0,0 +1,95 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_PARALLEL_HPP
+#define QUADTREE_PARALLEL_HPP
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+inline std::size_t hardwareThreads() {
+    unsigned threads = std::thread::hardware_concurrency();
+    return threads != 0 ? threads : 1;
+}
+
+// Calls task(i) for every i in [0, count). Tasks are handed out
+// one by one, so they may differ in cost. The calling thread works too.
+template <class Task>
+void parallelFor(std::size_t count, Task const& task,
+                 std::size_t threads = hardwareThreads()) {
+    threads = std::min(threads, count);
+    if (threads <= 1) {
+        for (std::size_t i = 0; i != count; ++i) task(i);
+        return;
+    }
+    
+    std::atomic<std::size_t> next { 0 };
+    auto work = [&] {
+        for (std::size_t i = next++; i < count; i = next++) task(i);
+    };
+    
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (std::size_t i = 1; i != threads; ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread& worker: workers) worker.join();
+}
+
+// Calls task(begin, end) for blocks of [0, count) that cover it entirely.
+// Suits cheap uniform per-element work, where a task per element is too fine.
+template <class Task>
+void parallelForRange(std::size_t count, Task const& task,
+                      std::size_t threads = hardwareThreads()) {
+    std::size_t const min_block = 1024;
+    std::size_t blocks = std::min(threads * 4, (count + min_block - 1) / min_block);
+    if (blocks <= 1) {
+        if (count != 0) task(std::size_t(0), count);
+        return;
+    }
+    
+    parallelFor(blocks, [&] (std::size_t block) {
+        task(count * block / blocks, count * (block + 1) / blocks);
+    }, threads);
+}
+
+// Sorts the chunks of the range in parallel, then merges neighbour chunks
+// pairwise, every level of the merge in parallel too
+template <class RandomIt, class Compare>
+void parallelSort(RandomIt first, RandomIt last, Compare comp,
+                  std::size_t threads = hardwareThreads()) {
+    std::size_t count = static_cast<std::size_t>(last - first);
+    std::size_t const min_chunk = 4096;
+    std::size_t chunks = std::min(threads, count / min_chunk + 1);
+    if (chunks <= 1) {
+        std::sort(first, last, comp);
+        return;
+    }
+    
+    std::vector<RandomIt> bounds;
+    for (std::size_t i = 0; i <= chunks; ++i) {
+        bounds.push_back(first + static_cast<std::ptrdiff_t>(count * i / chunks));
+    }
+    
+    parallelFor(chunks, [&] (std::size_t i) {
+        std::sort(bounds[i], bounds[i + 1], comp);
+    }, threads);
+    
+    for (std::size_t width = 1; width < chunks; width *= 2) {
+        std::size_t pairs = (chunks + 2 * width - 1) / (2 * width);
+        parallelFor(pairs, [&] (std::size_t pair) {
+            std::size_t low = pair * 2 * width;
+            std::size_t middle = std::min(low + width, chunks);
+            std::size_t high = std::min(low + 2 * width, chunks);
+            if (middle != high) {
+                std::inplace_merge(bounds[low], bounds[middle], bounds[high], comp);
+            }
+        }, threads);
+    }
+}
+
+#endif // QUADTREE_PARALLEL_HPP
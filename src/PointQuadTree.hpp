@@ -0,0 +1,300 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_POINTQUADTREE_HPP
+#define QUADTREE_POINTQUADTREE_HPP
+
+#include <array>
+#include <memory>
+#include <queue>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include "Box.hpp"
+#include "NodePool.hpp"
+#include "QuadTreeLimits.hpp"
+
+// Node of PointQuadTree. A point never straddles the axes of a node,
+// so only leaves keep values, next to their points.
+template <class T, class Real>
+class PointNode {
+  public:
+    using Pool = NodePool<PointNode>;
+    using Index = typename Pool::Index;
+    using Point = Vector2<Real>;
+    
+  public:
+    bool isLeaf() const {
+        return m_first_child == Pool::null;
+    }
+    
+    Index childIndex(int i) const {
+        return m_first_child + static_cast<Index>(i);
+    }
+    
+    std::vector<Point> const& points() const {
+        return m_points;
+    }
+    
+    std::vector<T> const& values() const {
+        return m_values;
+    }
+    
+  private:
+    template <class, class, class>
+    friend class PointQuadTree;
+    
+    Index m_first_child = Pool::null;
+    std::vector<Point> m_points;
+    std::vector<T> m_values;
+};
+
+// QuadTree of values at points. A point takes two coordinates where
+// a box takes four, its quadrant is found by two compares and no value
+// is kept above the leaves. A point matches a query box when it lies strictly
+// inside the box, like a zero sized box in QuadTree does.
+template <class T, class Real = float, class Limits = QuadTreeLimits<>>
+class PointQuadTree {
+  private:
+    using NodeType = PointNode<T, Real>;
+    using Pool = typename NodeType::Pool;
+    using Index = typename NodeType::Index;
+    
+  public:
+    using Point = Vector2<Real>;
+    using Box = ::Box<Real>;
+    
+  public:
+    explicit PointQuadTree(Box tree_box)
+    : m_tree_box(tree_box)
+    , m_pool(new Pool())
+    {
+        // The root is the first node of the first block
+        m_pool->allocateBlock();
+    }
+    
+    void add(Point const& point, T value) {
+        assert(inside(m_tree_box, point));
+        Index index = 0;
+        Box cell = m_tree_box;
+        std::size_t depth = 0;
+        while (true) {
+            NodeType& node = (*m_pool)[index];
+            if (!node.isLeaf()) {
+                int i = quadrant(cell, point);
+                index = node.childIndex(i);
+                cell = cell.quadrantByIndex(i);
+                ++depth;
+            } else if (depth >= Limits::max_depth || node.m_points.size() < Limits::max_values) {
+                node.m_points.push_back(point);
+                node.m_values.push_back(std::move(value));
+                ++m_size;
+                return;
+            } else {
+                split(node, cell);
+            }
+        }
+    }
+    
+    // Removes a value equal to the given one at the point
+    void remove(Point const& point, T const& value) {
+        assert(inside(m_tree_box, point));
+        // Path from the root for the merges
+        std::array<Index, Limits::max_depth + 1> path;
+        std::size_t depth = 0;
+        path[0] = 0;
+        Box cell = m_tree_box;
+        while (!(*m_pool)[path[depth]].isLeaf()) {
+            int i = quadrant(cell, point);
+            path[depth + 1] = (*m_pool)[path[depth]].childIndex(i);
+            cell = cell.quadrantByIndex(i);
+            ++depth;
+        }
+        
+        NodeType& leaf = (*m_pool)[path[depth]];
+        std::size_t slot = 0;
+        while (slot != leaf.m_points.size() &&
+               !(samePoint(leaf.m_points[slot], point) && leaf.m_values[slot] == value)) {
+            ++slot;
+        }
+        assert(slot != leaf.m_points.size() &&
+               "Trying to remove a value that is not present in the tree");
+        
+        leaf.m_points[slot] = leaf.m_points.back();
+        leaf.m_points.pop_back();
+        leaf.m_values[slot] = std::move(leaf.m_values.back());
+        leaf.m_values.pop_back();
+        --m_size;
+        
+        while (depth != 0 && tryMerge((*m_pool)[path[depth - 1]])) {
+            --depth;
+        }
+    }
+    
+    std::size_t size() const {
+        return m_size;
+    }
+    
+    // References stay valid until the tree is modified
+    std::vector<std::reference_wrapper<T const>> query(Box const& query_box) const {
+        std::vector<std::reference_wrapper<T const>> match_values;
+        queryVisit(query_box, [&match_values] (T const& value) {
+            match_values.push_back(std::cref(value));
+            return true;
+        });
+        return match_values;
+    }
+    
+    // Calls callback(T const&) for the values at points inside query_box
+    // until it returns false. Returns false if the callback stopped the query.
+    template <class Callback>
+    bool queryVisit(Box const& query_box, Callback callback) const {
+        if (!query_box.intersects(m_tree_box)) return true;
+        return visit(0, m_tree_box, query_box, callback);
+    }
+    
+    // Up to k values nearest to the point, the nearest first,
+    // see QuadTree::nearest()
+    std::vector<std::reference_wrapper<T const>> nearest(Point const& point, std::size_t k) const {
+        std::vector<std::reference_wrapper<T const>> found;
+        if (k == 0) return found;
+        
+        std::priority_queue<NearestItem, std::vector<NearestItem>, std::greater<NearestItem>> queue;
+        std::priority_queue<Real> best;
+        auto beyond = [&best, k] (Real distance) {
+            return best.size() == k && !(distance < best.top());
+        };
+        
+        queue.push(NearestItem { m_tree_box.distanceSquared(point), 0, m_tree_box, nullptr });
+        while (!queue.empty()) {
+            NearestItem item = queue.top();
+            queue.pop();
+            if (item.value) {
+                found.push_back(std::cref(*item.value));
+                if (found.size() == k) break;
+                continue;
+            }
+            
+            NodeType const& node = (*m_pool)[item.node];
+            if (node.isLeaf()) {
+                for (std::size_t i = 0; i != node.m_points.size(); ++i) {
+                    Real dx = node.m_points[i].x - point.x;
+                    Real dy = node.m_points[i].y - point.y;
+                    Real distance = dx * dx + dy * dy;
+                    if (beyond(distance)) continue;
+                    queue.push(NearestItem { distance, 0, Box(), &node.m_values[i] });
+                    best.push(distance);
+                    if (best.size() > k) best.pop();
+                }
+                continue;
+            }
+            for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+                Box child_box = item.box.quadrantByIndex(i);
+                Real distance = child_box.distanceSquared(point);
+                if (beyond(distance)) continue;
+                queue.push(NearestItem { distance, node.childIndex(i), child_box, nullptr });
+            }
+        }
+        return found;
+    }
+    
+  private:
+    // Node or value waiting in the queue of nearest()
+    struct NearestItem {
+        Real distance;
+        Index node;
+        Box box;
+        // Null for a node
+        T const* value;
+        
+        bool operator>(NearestItem const& other) const {
+            return distance > other.distance;
+        }
+    };
+    
+    // Same split of the cell as Box::quadrantIndex() gives a zero sized box
+    static int quadrant(Box const& cell, Point const& point) {
+        Vector2<Real> center = cell.getCenter();
+        return (point.x >= center.x ? 1 : 0) + (point.y >= center.y ? 2 : 0);
+    }
+    
+    static bool inside(Box const& box, Point const& point) {
+        return box.left <= point.x && point.x <= box.getRight() &&
+               box.top <= point.y && point.y <= box.getBottom();
+    }
+    
+    static bool samePoint(Point const& lhs, Point const& rhs) {
+        return std::memcmp(&lhs, &rhs, sizeof(Point)) == 0;
+    }
+    
+    void split(NodeType& node, Box const& cell) {
+        assert(node.isLeaf() && "Only leaves can be split");
+        Index first_child = m_pool->allocateBlock();
+        node.m_first_child = first_child;
+        for (std::size_t k = 0; k != node.m_points.size(); ++k) {
+            NodeType& child = (*m_pool)[first_child + static_cast<Index>(quadrant(cell, node.m_points[k]))];
+            child.m_points.push_back(node.m_points[k]);
+            child.m_values.push_back(std::move(node.m_values[k]));
+        }
+        node.m_points.clear();
+        node.m_values.clear();
+    }
+    
+    // Returns true if the children were merged into the node
+    bool tryMerge(NodeType& node) {
+        assert(!node.isLeaf() && "Only interior nodes can be merged");
+        std::size_t count = 0;
+        for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+            NodeType const& child = (*m_pool)[node.childIndex(i)];
+            if (!child.isLeaf()) return false;
+            count += child.m_points.size();
+        }
+        if (count > Limits::merge_values) return false;
+        
+        node.m_points.reserve(count);
+        node.m_values.reserve(count);
+        for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+            NodeType& child = (*m_pool)[node.childIndex(i)];
+            node.m_points.insert(node.m_points.end(), child.m_points.begin(), child.m_points.end());
+            for (T& value: child.m_values) node.m_values.push_back(std::move(value));
+        }
+        m_pool->freeBlock(node.m_first_child);
+        node.m_first_child = Pool::null;
+        return true;
+    }
+    
+    template <class Callback>
+    bool visit(Index index, Box const& cell, Box const& query_box, Callback& callback) const {
+        NodeType const& node = (*m_pool)[index];
+        if (node.isLeaf()) {
+            Real q_left = query_box.left, q_right = query_box.getRight();
+            Real q_top = query_box.top, q_bottom = query_box.getBottom();
+            for (std::size_t i = 0; i != node.m_points.size(); ++i) {
+                Point const& point = node.m_points[i];
+                bool inside = q_left < point.x && point.x < q_right &&
+                              q_top < point.y && point.y < q_bottom;
+                if (inside && !callback(node.m_values[i])) return false;
+            }
+            return true;
+        }
+        
+        for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+            Box child_box = cell.quadrantByIndex(i);
+            if (query_box.intersects(child_box) &&
+                !visit(node.childIndex(i), child_box, query_box, callback)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+  private:
+    Box m_tree_box;
+    // Owns every node of the tree
+    std::unique_ptr<Pool> m_pool;
+    std::size_t m_size = 0;
+};
+
+#endif // QUADTREE_POINTQUADTREE_HPP
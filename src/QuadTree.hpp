@@ -5,196 +5,1524 @@
 #ifndef QUADTREE_QUADTREE_HPP
 #define QUADTREE_QUADTREE_HPP
 
+#include <array>
+#include <cmath>
+#include <limits>
 #include <memory>
 #include <type_traits>
 #include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <functional>
+#include <string>
 #include "QuadTreeBase.hpp"
+#include "Parallel.hpp"
+#include "BoxArray.hpp"
+#include "NodePool.hpp"
+#include "LinearQuadTree.hpp"
+#include "QuadTreeLimits.hpp"
+#include "QuadTreeStats.hpp"
 
-template <class T, class Real>
+template <class T, class Real, class Limits>
+struct TreeStorage;
+
+// Stable name of a value in a QuadTree, valid until the value is removed
+struct QuadTreeHandle {
+    std::uint32_t id;
+    
+    bool operator==(QuadTreeHandle const& other) const {
+        return id == other.id;
+    }
+};
+
+template <class T, class Real, class Limits>
 class Node {
   public:
-    using Ptr = std::unique_ptr<Node>;
+    using Pool = NodePool<Node>;
+    using Index = typename Pool::Index;
+    using Storage = TreeStorage<T, Real, Limits>;
+    using Handle = QuadTreeHandle;
     using ValPtr = std::shared_ptr<ValueInBox<T, Real>>;
-    using Box = Box<Real>;
+    using Box = ::Box<Real>;
     using Quadrants = typename Box::Quadrants;
     
+    // Value with its path from the root: 3 bits per level, 0 when
+    // the value stays at the level, otherwise the quadrant index + 1.
+    // Sorted by the key, the values of every subtree are contiguous
+    // and the values kept in a node precede the values of its children.
+    struct BulkItem {
+        std::uint64_t key;
+        Box box;
+        ValPtr value;
+        Handle handle;
+    };
+    
+    // Changes of a batch the nodes leave for its end, see apply()
+    struct BatchLog {
+        // Nodes that lost values
+        std::vector<Index> touched;
+        std::vector<Handle> released;
+    };
+    
   public:
     bool isLeaf() const {
-        return m_children[0] == nullptr;
+        return m_first_child == Pool::null;
+    }
+    
+    static constexpr size_t getMaxDepth() {
+        return Limits::max_depth;
+    }
+    
+    static constexpr size_t getMaxValuesSize() {
+        return Limits::max_values;
     }
     
-    static size_t getMaxDepth() {
-        return 8;
+    static constexpr size_t getMergeValuesSize() {
+        return Limits::merge_values;
     }
     
-    static size_t getMaxValuesSize() {
-        return 16;
+    static constexpr bool isLoose() {
+        return Limits::looseness::num != Limits::looseness::den;
     }
     
-    void add(std::size_t depth, Box const& node_box, ValPtr const& value) {
-        assert(node_box.contains(value->getBox()));
+    // Box holding the values of a node with the cell, see looseBox()
+    static Box bounds(Box const& cell) {
+        return looseBox<typename Limits::looseness>(cell);
+    }
+    
+    // Child of the node with the cell the box goes to, if any
+    static Quadrants childFor(Box const& cell, Box const& box) {
+        if (!isLoose()) return cell.quadrantIndex(box);
+        
+        Vector2<Real> center = box.getCenter();
+        Box point(center.x, center.y, 0, 0);
+        Quadrants i = cell.quadrantIndex(point);
+        if (i != Quadrants::NEITHER_ONE_QUADRANT && bounds(cell.quadrantByIndex(i)).contains(box)) {
+            return i;
+        }
+        return Quadrants::NEITHER_ONE_QUADRANT;
+    }
+    
+    // Stores the value indexed by box under the handle
+    void add(Storage& storage, Index self, std::size_t depth, Box const& node_box,
+             ValPtr&& value, Box const& box, Handle handle) {
+        assert(bounds(node_box).contains(box));
         if (isLeaf()) {
             if(depth >= getMaxDepth() || m_values.size() < getMaxValuesSize()) {
                 // Insert the value in this node if possible
-                push(value);
+                append(storage, self, std::move(value), box, handle);
             } else {
                 // Otherwise, we split and we try again
-                split(node_box);
-                add(depth, node_box, value);
+                split(storage, self, node_box);
+                add(storage, self, depth, node_box, std::move(value), box, handle);
             }
         } else {
-            Quadrants i = node_box.quadrantIndex(value->getBox());
+            Quadrants i = childFor(node_box, box);
             if(i != Quadrants::NEITHER_ONE_QUADRANT) {
                 // Add the value in a child if the value is entirely contained in it
-                child(i)->add(depth + 1, node_box.quadrantByIndex(i), value);
+                child(storage.pool, i).add(
+                    storage, childIndex(i), depth + 1, node_box.quadrantByIndex(i),
+                    std::move(value), box, handle
+                );
             } else {
                 // Otherwise, we add the value in the current node
-                push(value);
+                append(storage, self, std::move(value), box, handle);
             }
         }
     }
     
-    void remove(Box const& node_box, ValPtr const& value, Node* parent = nullptr) {
-        assert(node_box.contains(value->getBox()));
+    static std::uint64_t bulkKey(Box node_box, Box const& value_box) {
+        static_assert(sizeof(std::uint64_t) * 8 >= 3 * getMaxDepth(), "Key holds every level");
+        std::uint64_t key = 0;
+        bool stopped = false;
+        for (std::size_t depth = 0; depth != getMaxDepth(); ++depth) {
+            key <<= 3;
+            if (stopped) continue;
+            
+            Quadrants i = childFor(node_box, value_box);
+            if (i != Quadrants::NEITHER_ONE_QUADRANT) {
+                key |= static_cast<std::uint64_t>(i + 1);
+                node_box = node_box.quadrantByIndex(i);
+            } else {
+                stopped = true;
+            }
+        }
+        return key;
+    }
+    
+    // Builds the subtree from the items sorted by bulkKey at once.
+    // The shape is the one add() gives for the same values: a node is split
+    // only when more than getMaxValuesSize() values reach it above getMaxDepth().
+    // Subtrees above parallel_depth are built in parallel.
+    template <class ItemIt>
+    void build(Storage& storage, Index self, std::size_t depth, Box const& node_box,
+               ItemIt first, ItemIt last, std::size_t parallel_depth) {
+        assert(isLeaf() && m_values.empty());
+        std::size_t count = static_cast<std::size_t>(last - first);
+        if (depth >= getMaxDepth() || count <= getMaxValuesSize()) {
+            reserve(count);
+            for (; first != last; ++first) {
+                append(storage, self, std::move(first->value), first->box, first->handle);
+            }
+            return;
+        }
+        
+        allocateChildren(storage, self);
+        
+        std::size_t shift = 3 * (getMaxDepth() - depth - 1);
+        auto digit = [shift] (BulkItem const& item) {
+            return static_cast<int>((item.key >> shift) & 7);
+        };
+        
+        ItemIt stay_end = std::partition_point(
+            first, last, [&digit] (BulkItem const& item) { return digit(item) == 0; }
+        );
+        reserve(static_cast<std::size_t>(stay_end - first));
+        for (ItemIt it = first; it != stay_end; ++it) {
+            append(storage, self, std::move(it->value), it->box, it->handle);
+        }
+        
+        // Bounds of the children ranges
+        std::array<ItemIt, 5> bounds;
+        bounds[0] = stay_end;
+        for (int i = 0; i != 4; ++i) {
+            bounds[static_cast<std::size_t>(i) + 1] = std::partition_point(
+                bounds[static_cast<std::size_t>(i)], last,
+                [&digit, i] (BulkItem const& item) { return digit(item) <= i + 1; }
+            );
+        }
+        
+        auto build_child = [&] (std::size_t i) {
+            int q = static_cast<int>(i);
+            child(storage.pool, q).build(
+                storage, childIndex(q), depth + 1, node_box.quadrantByIndex(q),
+                bounds[i], bounds[i + 1], parallel_depth
+            );
+        };
+        parallelFor(Pool::BlockSize, build_child, depth < parallel_depth ? 4 : 1);
+    }
+    
+    // Removes the items of removes and adds the items of adds in one descent,
+    // both sorted by bulkKey. The items going through the node are split
+    // into the ranges of its children, a leaf overflowing by the adds is
+    // built anew to its final shape. Nothing is merged and no handle is
+    // released, the log keeps them for the end of the batch.
+    // Subtrees above parallel_depth are changed in parallel.
+    template <class ItemIt>
+    void apply(Storage& storage, Index self, std::size_t depth, Box const& node_box,
+               ItemIt adds_first, ItemIt adds_last, ItemIt removes_first, ItemIt removes_last,
+               std::size_t parallel_depth, BatchLog& log) {
         if (isLeaf()) {
-            remove(value);
-            if (parent) parent->tryMerge();
+            for (ItemIt it = removes_first; it != removes_last; ++it) {
+                detach(storage, self, node_box, it->value, log);
+            }
+            applyToLeaf(storage, self, depth, node_box, adds_first, adds_last, parallel_depth);
+            return;
         }
-        else {
-            Quadrants i = node_box.quadrantIndex(value->getBox());
-            if (i != Quadrants::NEITHER_ONE_QUADRANT) {
-                child(i)->remove(node_box.quadrantByIndex(i), value, this);
+        
+        // The tree grew and pushed the node past the max depth, below the
+        // levels the keys hold: the items go through it one by one
+        if (depth >= getMaxDepth()) {
+            for (ItemIt it = removes_first; it != removes_last; ++it) {
+                detach(storage, self, node_box, it->value, log);
             }
-            else {
-                // Remove the value in a child
-                // if the value is entirely contained in it
-                remove(value);
+            for (ItemIt it = adds_first; it != adds_last; ++it) {
+                add(storage, self, depth, node_box, std::move(it->value), it->box, it->handle);
+            }
+            return;
+        }
+        
+        std::size_t shift = 3 * (getMaxDepth() - depth - 1);
+        auto digit = [shift] (BulkItem const& item) {
+            return static_cast<int>((item.key >> shift) & 7);
+        };
+        auto stays = [&digit] (BulkItem const& item) { return digit(item) == 0; };
+        
+        // The values kept by the node itself, found in the children
+        // if the tree grew since they were added
+        ItemIt removes_stay_end = std::partition_point(removes_first, removes_last, stays);
+        for (ItemIt it = removes_first; it != removes_stay_end; ++it) {
+            detach(storage, self, node_box, it->value, log);
+        }
+        ItemIt adds_stay_end = std::partition_point(adds_first, adds_last, stays);
+        reserve(m_values.size() + static_cast<std::size_t>(adds_stay_end - adds_first));
+        for (ItemIt it = adds_first; it != adds_stay_end; ++it) {
+            append(storage, self, std::move(it->value), it->box, it->handle);
+        }
+        
+        // Bounds of the children ranges
+        std::array<ItemIt, 5> adds_bounds, removes_bounds;
+        adds_bounds[0] = adds_stay_end;
+        removes_bounds[0] = removes_stay_end;
+        for (int i = 0; i != 4; ++i) {
+            auto before_next = [&digit, i] (BulkItem const& item) { return digit(item) <= i + 1; };
+            std::size_t k = static_cast<std::size_t>(i);
+            adds_bounds[k + 1] = std::partition_point(adds_bounds[k], adds_last, before_next);
+            removes_bounds[k + 1] = std::partition_point(removes_bounds[k], removes_last, before_next);
+        }
+        
+        std::array<BatchLog, 4> logs;
+        auto apply_child = [&] (std::size_t i) {
+            if (adds_bounds[i] == adds_bounds[i + 1] && removes_bounds[i] == removes_bounds[i + 1]) return;
+            int q = static_cast<int>(i);
+            child(storage.pool, q).apply(
+                storage, childIndex(q), depth + 1, node_box.quadrantByIndex(q),
+                adds_bounds[i], adds_bounds[i + 1], removes_bounds[i], removes_bounds[i + 1],
+                parallel_depth, logs[i]
+            );
+        };
+        parallelFor(Pool::BlockSize, apply_child, depth < parallel_depth ? 4 : 1);
+        for (BatchLog const& child_log: logs) {
+            log.touched.insert(log.touched.end(), child_log.touched.begin(), child_log.touched.end());
+            log.released.insert(log.released.end(), child_log.released.begin(), child_log.released.end());
+        }
+    }
+    
+    // Returns false if no stored value is equal to the given one
+    bool remove(Storage& storage, Index self, Box const& node_box, ValPtr const& value) {
+        Index node = Pool::null;
+        std::size_t slot = 0;
+        bool found = locate(storage.pool, self, node_box, value, node, slot);
+        assert(found && "Trying to remove a value that is not present in the tree");
+        if (!found) return false;
+        
+        Node& owner = storage.pool[node];
+        storage.releaseHandle(owner.m_handles[slot]);
+        owner.erase(storage, slot);
+        if (storage.defer_merges) {
+            markDirty(storage, node);
+        } else if (owner.isLeaf() && owner.m_parent != Pool::null) {
+            storage.pool[owner.m_parent].tryMerge(storage, owner.m_parent);
+        }
+        return true;
+    }
+    
+    // Handle of the stored value equal to the given one,
+    // an invalid handle if there is none
+    Handle find(Pool const& pool, Index self, Box const& node_box, ValPtr const& value) const {
+        Index node = Pool::null;
+        std::size_t slot = 0;
+        bool found = locate(pool, self, node_box, value, node, slot);
+        assert(found && "Trying to find a value that is not present in the tree");
+        if (!found) return Handle { Pool::null };
+        return pool[node].m_handles[slot];
+    }
+    
+    // Node and slot of the stored value equal to the given one, searched on
+    // the path add() gives the value. A value kept by the root before the tree
+    // grew may lie below the end of its path: the search then goes on in
+    // the children holding the value.
+    bool locate(Pool const& pool, Index self, Box const& node_box, ValPtr const& value,
+                Index& node, std::size_t& slot) const {
+        Box box = value->getBox();
+        assert(bounds(node_box).contains(box));
+        Quadrants i = isLeaf() ? Quadrants::NEITHER_ONE_QUADRANT : childFor(node_box, box);
+        if (i != Quadrants::NEITHER_ONE_QUADRANT) {
+            return child(pool, i).locate(pool, childIndex(i), node_box.quadrantByIndex(i), value, node, slot);
+        }
+        
+        auto found = std::find_if(
+            m_values.begin(), m_values.end(),
+            [&value] (ValPtr const& rhs) {
+                return *value == *rhs;
+            }
+        );
+        if (found != m_values.end()) {
+            node = self;
+            slot = static_cast<std::size_t>(found - m_values.begin());
+            return true;
+        }
+        
+        if (isLeaf()) return false;
+        for (int c = 0; c != static_cast<int>(Pool::BlockSize); ++c) {
+            Box cell = node_box.quadrantByIndex(c);
+            if (bounds(cell).contains(box) &&
+                child(pool, c).locate(pool, childIndex(c), cell, value, node, slot)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Makes the block of first_child the children of the node
+    void attachChildren(Pool& pool, Index self, Index first_child) {
+        m_first_child = first_child;
+        for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+            child(pool, i).m_parent = self;
+        }
+    }
+    
+    // Takes the values and the children of the other node,
+    // which is left an empty leaf
+    void adopt(Storage& storage, Index self, Node& other) {
+        assert(isLeaf() && m_values.empty());
+        m_values = std::move(other.m_values);
+        m_boxes = std::move(other.m_boxes);
+        m_handles = std::move(other.m_handles);
+        other.m_values.clear();
+        other.m_handles.clear();
+        for (Handle handle: m_handles) {
+            storage.locations[handle.id].node = self;
+        }
+        
+        Index first_child = other.m_first_child;
+        other.m_first_child = Pool::null;
+        if (first_child != Pool::null) attachChildren(storage.pool, self, first_child);
+        
+        // The entry of the other node in the dirty list goes stale
+        if (other.m_dirty) {
+            other.m_dirty = false;
+            markDirty(storage, self);
+        }
+    }
+    
+    // Takes the value at the slot out of the node, its handle stays taken
+    ValPtr extract(Storage& storage, std::size_t slot) {
+        ValPtr value = std::move(m_values[slot]);
+        erase(storage, slot);
+        return value;
+    }
+    
+    void setBox(std::size_t slot, Box const& box) {
+        m_boxes.set(slot, box);
+    }
+    
+    // Removes the value at the slot without any search, then merges
+    // the ancestors while they become mergeable
+    void removeAt(Storage& storage, Index self, std::size_t slot) {
+        storage.releaseHandle(m_handles[slot]);
+        erase(storage, slot);
+        if (storage.defer_merges) {
+            markDirty(storage, self);
+        } else {
+            mergeUp(storage, isLeaf() ? m_parent : self, Pool::null);
+        }
+    }
+    
+    // Merges the node, then its ancestors while the merges succeed.
+    // The node last is the highest one merged.
+    static void mergeUp(Storage& storage, Index merging, Index last) {
+        while (merging != Pool::null && storage.pool[merging].tryMerge(storage, merging)) {
+            if (merging == last) break;
+            merging = storage.pool[merging].m_parent;
+        }
+    }
+    
+    // Leaves the node that lost values to compact(), once
+    static void markDirty(Storage& storage, Index node) {
+        if (storage.pool[node].m_dirty) return;
+        storage.pool[node].m_dirty = true;
+        storage.dirty.push_back(node);
+    }
+    
+    // Works off the nodes marked dirty in up to budget steps, the last marked
+    // first. A step shrinks the arrays of a node or tries to merge a node
+    // with its children, the merges go bottom-up from the dirty node.
+    // Returns true if no dirty node is left.
+    static bool compact(Storage& storage, std::size_t budget) {
+        while (budget != 0 && !storage.dirty.empty()) {
+            Index index = storage.dirty.back();
+            storage.dirty.pop_back();
+            Node& node = storage.pool[index];
+            // A node freed by a merge since it was marked is clean
+            if (!node.m_dirty) continue;
+            node.m_dirty = false;
+            node.shrink();
+            --budget;
+            
+            Index merging = node.isLeaf() ? node.m_parent : index;
+            while (merging != Pool::null) {
+                if (budget == 0) {
+                    // The climb goes on from here in the next call
+                    markDirty(storage, merging);
+                    break;
+                }
+                --budget;
+                if (!storage.pool[merging].tryMerge(storage, merging)) break;
+                merging = storage.pool[merging].m_parent;
             }
         }
+        return storage.dirty.empty();
     }
     
-    void query(Box const& node_box, Box const& query_box,
-               std::vector<ValPtr>& match_values) {
-        assert(query_box.intersects(node_box));
-        for (ValPtr& value: m_values) {
-            if(query_box.intersects(value->getBox())) {
-                match_values.push_back(value);
+    void query(Pool const& pool, Box const& node_box, Box const& query_box,
+               std::vector<ValPtr>& match_values) const {
+        assert(query_box.intersects(bounds(node_box)));
+        QUADTREE_COUNT_QUERY(nodes_visited, 1);
+        QUADTREE_COUNT_QUERY(boxes_tested, m_boxes.size());
+        auto match = [this, &match_values] (std::size_t i) {
+            QUADTREE_COUNT_QUERY(matches, 1);
+            match_values.push_back(m_values[i]);
+            return true;
+        };
+        m_boxes.forEachIntersecting(query_box, match);
+        
+        if(!isLeaf()) {
+            for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+                Box child_box = node_box.quadrantByIndex(i);
+                QUADTREE_COUNT_QUERY(boxes_tested, 1);
+                if(query_box.intersects(bounds(child_box))) {
+                    child(pool, i).query(pool, child_box, query_box, match_values);
+                }
             }
         }
+    }
+    
+    // Calls visitor(value) for every value intersecting query_box while
+    // the visitor returns true. Returns false if the visit was stopped.
+    template <class Visitor>
+    bool visit(Pool const& pool, Box const& node_box, Box const& query_box,
+               Visitor& visitor) const {
+        assert(query_box.intersects(bounds(node_box)));
+        QUADTREE_COUNT_QUERY(nodes_visited, 1);
+        QUADTREE_COUNT_QUERY(boxes_tested, m_boxes.size());
+        auto match = [this, &visitor] (std::size_t i) {
+            QUADTREE_COUNT_QUERY(matches, 1);
+            return visitor(m_values[i]);
+        };
+        if (!m_boxes.forEachIntersecting(query_box, match)) {
+            return false;
+        }
         
         if(!isLeaf()) {
-            for (int i = 0; i != static_cast<int>(m_children.size()); ++i) {
+            for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
                 Box child_box = node_box.quadrantByIndex(i);
-                if(query_box.intersects(child_box)) {
-                    query(child_box, query_box, match_values);
+                QUADTREE_COUNT_QUERY(boxes_tested, 1);
+                if(query_box.intersects(bounds(child_box)) &&
+                   !child(pool, i).visit(pool, child_box, query_box, visitor)) {
+                    return false;
                 }
             }
         }
+        return true;
     }
-  
+    
+    std::vector<ValPtr> const& values() const {
+        return m_values;
+    }
+    
+    BoxArray<Real> const& boxes() const {
+        return m_boxes;
+    }
+    
+    Index parent() const {
+        return m_parent;
+    }
+    
+    Index childIndex(int i) const {
+        return m_first_child + static_cast<Index>(i);
+    }
+    
+    Node& child(Pool& pool, int i) const {
+        return pool[childIndex(i)];
+    }
+    
+    Node const& child(Pool const& pool, int i) const {
+        return pool[childIndex(i)];
+    }
+    
+    // Heap bytes of the arrays of the node, the values themselves excluded
+    std::size_t bytes() const {
+        return m_values.capacity() * sizeof(ValPtr) + m_boxes.capacity() * 4 * sizeof(Real) +
+               m_handles.capacity() * sizeof(Handle);
+    }
+    
   private:
-    Ptr& child(int i) {
-        return m_children[static_cast<std::size_t>(i)];
+    // Every value movement goes through append() and erase(),
+    // they keep the handle locations up to date
+    void append(Storage& storage, Index self, ValPtr&& value, Box const& box, Handle handle) {
+        storage.locations[handle.id] = { self, static_cast<std::uint32_t>(m_values.size()) };
+        m_values.push_back(std::move(value));
+        m_boxes.push_back(box);
+        m_handles.push_back(handle);
     }
     
-    void push(ValPtr const& value) {
-        m_values.push_back(value->clone());
+    // Moves the last value into the slot
+    void erase(Storage& storage, std::size_t slot) {
+        std::size_t last = m_values.size() - 1;
+        if (slot != last) {
+            m_values[slot] = std::move(m_values[last]);
+            m_handles[slot] = m_handles[last];
+            storage.locations[m_handles[slot].id].slot = static_cast<std::uint32_t>(slot);
+        }
+        m_values.pop_back();
+        m_boxes.swapRemove(slot);
+        m_handles.pop_back();
     }
     
-    void split(Box const& node_box) {
-        assert(isLeaf() && "Only leaves can be split");
-        // Create m_children
-        for (Ptr& child: m_children) {
-            child.reset(new Node());
+    void reserve(std::size_t count) {
+        m_values.reserve(count);
+        m_boxes.reserve(count);
+        m_handles.reserve(count);
+    }
+    
+    // Takes the value equal to the given one out of the node or the subtree
+    // below it, for apply()
+    void detach(Storage& storage, Index self, Box const& node_box, ValPtr const& value, BatchLog& log) {
+        Index node = Pool::null;
+        std::size_t slot = 0;
+        bool found = locate(storage.pool, self, node_box, value, node, slot);
+        assert(found && "Trying to remove a value that is not present in the tree");
+        if (!found) return;
+        
+        Node& owner = storage.pool[node];
+        log.released.push_back(owner.m_handles[slot]);
+        log.touched.push_back(node);
+        owner.erase(storage, slot);
+    }
+    
+    // Adds the items to the leaf, which is split once to its final shape
+    // if they overflow it: its values and the items are built anew
+    template <class ItemIt>
+    void applyToLeaf(Storage& storage, Index self, std::size_t depth, Box const& node_box,
+                     ItemIt first, ItemIt last, std::size_t parallel_depth) {
+        std::size_t count = m_values.size() + static_cast<std::size_t>(last - first);
+        if (depth >= getMaxDepth() || count <= getMaxValuesSize()) {
+            reserve(count);
+            for (; first != last; ++first) {
+                append(storage, self, std::move(first->value), first->box, first->handle);
+            }
+            return;
         }
         
-        // Redirect m_values to m_children if it entire in m_children
-        std::vector<ValPtr> new_this_values;
-        for (ValPtr& value: m_values) {
-            Quadrants i = node_box.quadrantIndex(value->getBox());
+        // Keys of the paths from this node, build() reads no upper levels
+        std::uint64_t mask = (std::uint64_t(1) << (3 * (getMaxDepth() - depth))) - 1;
+        std::vector<BulkItem> items;
+        items.reserve(count);
+        for (std::size_t k = 0; k != m_values.size(); ++k) {
+            Box box = m_boxes[k];
+            items.push_back(BulkItem { bulkKey(node_box, box) >> (3 * depth), box,
+                                       std::move(m_values[k]), m_handles[k] });
+        }
+        for (; first != last; ++first) {
+            items.push_back(BulkItem { first->key & mask, first->box, std::move(first->value), first->handle });
+        }
+        m_values.clear();
+        m_boxes.clear();
+        m_handles.clear();
+        std::sort(items.begin(), items.end(), [] (BulkItem const& lhs, BulkItem const& rhs) {
+            return lhs.key < rhs.key;
+        });
+        build(storage, self, depth, node_box, items.begin(), items.end(), parallel_depth);
+    }
+    
+    // Gives back the memory of the arrays if they are mostly unused
+    void shrink() {
+        if (m_values.capacity() <= 2 * m_values.size()) return;
+        m_values.shrink_to_fit();
+        m_boxes.shrink_to_fit();
+        m_handles.shrink_to_fit();
+    }
+    
+    void allocateChildren(Storage& storage, Index self) {
+        // The children lie next to each other in the pool
+        attachChildren(storage.pool, self, storage.pool.allocateBlock());
+    }
+    
+    void split(Storage& storage, Index self, Box const& node_box) {
+        assert(isLeaf() && "Only leaves can be split");
+        allocateChildren(storage, self);
+        
+        // Redirect m_values to the children if it entire in a child
+        std::vector<ValPtr> values = std::move(m_values);
+        BoxArray<Real> boxes = std::move(m_boxes);
+        std::vector<Handle> handles = std::move(m_handles);
+        m_values.clear();
+        m_handles.clear();
+        for (std::size_t k = 0; k != values.size(); ++k) {
+            Box box = boxes[k];
+            Quadrants i = childFor(node_box, box);
             if(i != Quadrants::NEITHER_ONE_QUADRANT) {
-                child(i)->m_values.push_back(std::move(value));
+                child(storage.pool, i).append(
+                    storage, childIndex(i), std::move(values[k]), box, handles[k]
+                );
             }
             else {
-                new_this_values.push_back(std::move(value));
+                append(storage, self, std::move(values[k]), box, handles[k]);
             }
         }
-        m_values = std::move(new_this_values);
     }
     
-    void remove(ValPtr const& value) {
-        auto found = std::find_if(
-            m_values.begin(), m_values.end(),
-            [this, &value] (ValPtr const& rhs) {
-                return *value == *rhs;
-            }
-        );
-        assert(found != m_values.end() &&
-               "Trying to remove a value that is not present in the node");
-        
-        *found = std::move(m_values.back());
-        m_values.pop_back();
-    }
-    
-    void tryMerge() {
+    // Returns true if the children were merged into this node
+    bool tryMerge(Storage& storage, Index self) {
         assert(!isLeaf() && "Only interior nodes can be merged");
         size_t count_child_values = m_values.size();
-        for (Ptr const& child: m_children) {
-            if (!child->isLeaf()) return;
-            count_child_values += child->m_values.size();
+        for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+            Node const& child = this->child(storage.pool, i);
+            if (!child.isLeaf()) return false;
+            count_child_values += child.m_values.size();
         }
         
-        if (count_child_values <= getMaxValuesSize()) {
-            m_values.reserve(count_child_values);
-            for (Ptr& child: m_children) {
-                for (ValPtr& value: child->m_values) {
-                    m_values.push_back(std::move(value));
-                }
-            }
-            
-            for (Ptr& child: m_children) {
-                child.reset();
+        if (count_child_values > getMergeValuesSize()) return false;
+        
+        reserve(count_child_values);
+        for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+            Node& child = this->child(storage.pool, i);
+            for (std::size_t k = 0; k != child.m_values.size(); ++k) {
+                append(storage, self, std::move(child.m_values[k]),
+                       child.m_boxes[k], child.m_handles[k]);
             }
         }
+        
+        // The children block goes back to the pool's free list
+        storage.pool.freeBlock(m_first_child);
+        m_first_child = Pool::null;
+        return true;
     }
   
   private:
-    std::array<std::unique_ptr<Node>, 4> m_children;
+    // Children are pool[m_first_child] .. pool[m_first_child + 3]
+    Index m_first_child = Pool::null;
+    Index m_parent = Pool::null;
     std::vector<ValPtr> m_values = { };
+    // Boxes of m_values in the same order, tested by the vector kernel
+    BoxArray<Real> m_boxes;
+    // Handles of m_values in the same order
+    std::vector<Handle> m_handles;
+    // Lost values while the merges were deferred, see compact()
+    bool m_dirty = false;
+};
+
+// Nodes of a QuadTree and the locations of its values by handle
+template <class T, class Real, class Limits>
+struct TreeStorage {
+    using NodeType = Node<T, Real, Limits>;
+    using Index = typename NodeType::Index;
+    using Handle = QuadTreeHandle;
+    
+    struct Location {
+        Index node;
+        std::uint32_t slot;
+    };
+    
+    NodePool<NodeType> pool;
+    std::vector<Location> locations;
+    std::vector<Handle> free_handles;
+    // Removals only mark the nodes, see QuadTree::deferMerges()
+    bool defer_merges = false;
+    std::vector<Index> dirty;
+    
+    Handle acquireHandle() {
+        if (!free_handles.empty()) {
+            Handle handle = free_handles.back();
+            free_handles.pop_back();
+            return handle;
+        }
+        locations.push_back({ NodeType::Pool::null, 0 });
+        return Handle { static_cast<std::uint32_t>(locations.size() - 1) };
+    }
+    
+    void releaseHandle(Handle handle) {
+        locations[handle.id] = { NodeType::Pool::null, 0 };
+        free_handles.push_back(handle);
+    }
+    
+    bool isValid(Handle handle) const {
+        return handle.id < locations.size() && locations[handle.id].node != NodeType::Pool::null;
+    }
+    
+    void clear() {
+        pool.clear();
+        locations.clear();
+        free_handles.clear();
+        dirty.clear();
+    }
+};
+
+// Results of many queries in one buffer: matches of the query i
+// are values[offsets[i]] .. values[offsets[i + 1] - 1]
+template <class ValPtr>
+struct QueryBatchResult {
+    std::vector<std::size_t> offsets;
+    std::vector<ValPtr> values;
+    
+    std::size_t size() const {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+    
+    std::size_t count(std::size_t query) const {
+        return offsets[query + 1] - offsets[query];
+    }
+    
+    ValPtr const* begin(std::size_t query) const {
+        return values.data() + offsets[query];
+    }
+    
+    ValPtr const* end(std::size_t query) const {
+        return values.data() + offsets[query + 1];
+    }
 };
 
-template<class T, class Real = float>
+template<class T, class Real = float, class Limits = QuadTreeLimits<>>
 class QuadTree: public QuadTreeBase<T, Real> {
   private:
-    using NodeType = Node<T, Real>;
-    using NodePtr = std::unique_ptr<NodeType>;
+    using NodeType = Node<T, Real, Limits>;
+    using Pool = typename NodeType::Pool;
+    using Storage = TreeStorage<T, Real, Limits>;
     using Box = typename QuadTreeBase<T, Real>::Box;
     using ValPtr = typename QuadTreeBase<T, Real>::ValPtr;
+    using Value = typename QuadTreeBase<T, Real>::Value;
     using Quadrants = typename Box::Quadrants;
-  
+    
   public:
+    using Handle = QuadTreeHandle;
+    
+    // Value hit by a ray at origin + t * direction
+    struct RayHit {
+        ValPtr value;
+        Real t;
+    };
+    
+  public:
+    // The tree box is widened to the grid of growableBox(), by less than
+    // a 2^-(digits / 2) part of its extent: a box of round numbers stays
     explicit QuadTree(Box tree_box)
-    : m_tree_box(tree_box)
-    , m_root_node(new NodeType())
-    { }
+    : m_tree_box(growableBox(tree_box))
+    , m_storage(new Storage())
+    {
+        // The root is the first node of the first block
+        m_storage->pool.allocateBlock();
+    }
+    
+    template <class InputIt>
+    QuadTree(Box tree_box, InputIt first, InputIt last)
+    : QuadTree(tree_box)
+    {
+        bulkLoad(first, last);
+    }
+    
+    // Replaces the content of the tree by the values of [first, last).
+    // Gives the same tree as add() of every value, but without descents
+    // and splits per value: the values are ordered by their paths from
+    // the root and every subtree is built from its contiguous range.
+    // The value number i of the range gets the handle i.
+    // The tree box grows to hold every value.
+    template <class InputIt>
+    void bulkLoad(InputIt first, InputIt last, std::size_t threads = hardwareThreads()) {
+        assert(m_tree_box.width > 0 && m_tree_box.height > 0);
+        std::vector<BulkItem> items;
+        for (; first != last; ++first) {
+            items.push_back(BulkItem { 0, Box(), *first, Handle { static_cast<std::uint32_t>(items.size()) } });
+        }
+        
+        parallelForRange(items.size(), [this, &items] (std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i != end; ++i) {
+                BulkItem& item = items[i];
+                item.value = item.value->clone();
+                item.box = item.value->getBox();
+            }
+        }, threads);
+        
+        // The content is replaced, only the box grows
+        for (BulkItem const& item: items) {
+            int quadrant = 0;
+            while (!m_tree_box.contains(item.box)) m_tree_box = doubledToward(item.box, quadrant);
+        }
+        
+        m_storage->clear();
+        // Every handle is taken, the build only writes the locations
+        m_storage->locations.resize(items.size());
+        build(items, threads);
+        m_size = items.size();
+    }
     
     void add(ValPtr const& value) override {
-        m_root_node->add(0, m_tree_box, value);
+        insert(value);
+    }
+    
+    // Same as add(), returns the handle of the stored value.
+    // The tree grows if the value lies out of the tree box.
+    Handle insert(ValPtr const& value) {
+        ValPtr clone = value->clone();
+        Box box = clone->getBox();
+        growToward(box);
+        Handle handle = m_storage->acquireHandle();
+        root().add(*m_storage, 0, 0, m_tree_box, std::move(clone), box, handle);
+        ++m_size;
+        return handle;
+    }
+    
+    // Doubles the tree box toward the box until it holds it. Every doubling
+    // makes a new root and turns the old one into its quadrant at the cost of
+    // moving the old root's own values: the rest of the tree stays in place,
+    // so a tree may start tight and deep.
+    void growToward(Box const& box) {
+        assert(m_tree_box.width > 0 && m_tree_box.height > 0);
+        while (!m_tree_box.contains(box)) {
+            int quadrant = 0;
+            Box grown = doubledToward(box, quadrant);
+            assert(grown.quadrantByIndex(quadrant) == m_tree_box &&
+                   "The tree has outgrown the precision of its coordinates");
+            m_tree_box = grown;
+            Pool& pool = m_storage->pool;
+            Index block = pool.allocateBlock();
+            Index old_root = block + static_cast<Index>(quadrant);
+            pool[old_root].adopt(*m_storage, old_root, root());
+            root().attachChildren(pool, 0, block);
+        }
     }
     
     void remove(ValPtr const& value) override {
-        m_root_node->remove(m_tree_box, value);
+        if (root().remove(*m_storage, 0, m_tree_box, value)) --m_size;
+    }
+    
+    // Removes the value in O(1) without a descent from the root or
+    // a search in the node, then merges the emptied ancestors.
+    // The handle becomes invalid and may be given to a later value.
+    void remove(Handle handle) {
+        assert(contains(handle) && "Trying to remove a value by an invalid handle");
+        typename Storage::Location location = m_storage->locations[handle.id];
+        m_storage->pool[location.node].removeAt(*m_storage, location.node, location.slot);
+        --m_size;
+    }
+    
+    // Moves the value to new_box in place of remove() and add(): no clone,
+    // and no structural work while the value stays in its node. Otherwise
+    // the value climbs to the deepest ancestor containing new_box and is
+    // added from there, the nodes it left are merged on the way.
+    // The tree indexes the value by new_box from now on: a value whose
+    // getBox() follows its state should be changed through get(handle).
+    void update(Handle handle, Box const& new_box) {
+        assert(contains(handle) && "Trying to update a value by an invalid handle");
+        // The tree grows if new_box lies out of the tree box
+        growToward(new_box);
+        typename Storage::Location location = m_storage->locations[handle.id];
+        Box node_box;
+        std::size_t depth = 0;
+        Index target = deepestContaining(location.node, new_box, node_box, depth);
+        
+        NodeType& node = m_storage->pool[location.node];
+        bool stays = node.isLeaf() ||
+                     NodeType::childFor(node_box, new_box) == Quadrants::NEITHER_ONE_QUADRANT;
+        if (target == location.node && stays) {
+            node.setBox(location.slot, new_box);
+            return;
+        }
+        
+        ValPtr value = node.extract(*m_storage, location.slot);
+        if (m_storage->defer_merges) {
+            NodeType::markDirty(*m_storage, location.node);
+        } else {
+            // Merges stay inside the subtree of target, so target survives them
+            NodeType::mergeUp(*m_storage, node.isLeaf() ? node.parent() : location.node, target);
+        }
+        m_storage->pool[target].add(
+            *m_storage, target, depth, node_box, std::move(value), new_box, handle
+        );
+    }
+    
+    // Same for the stored value equal to the given one,
+    // which is found by the box value->getBox() it is indexed with
+    void update(ValPtr const& value, Box const& new_box) {
+        Handle handle = root().find(m_storage->pool, 0, m_tree_box, value);
+        if (contains(handle)) update(handle, new_box);
+    }
+    
+    // Removes the stored values equal to removes, then adds copies of adds,
+    // all in one descent instead of one per value. The batch is ordered by
+    // the paths of the values from the root like in bulkLoad(), so every node
+    // is reached once by the values going through it, a leaf overflowing by
+    // the adds is split at once to its final shape, and the merges run once
+    // at the end. Subtrees are changed in parallel.
+    // Returns the handles of the added values in the order of adds.
+    // The tree grows if added values lie out of the tree box.
+    std::vector<Handle> apply(std::vector<ValPtr> const& adds, std::vector<ValPtr> const& removes,
+                              std::size_t threads = hardwareThreads()) {
+        std::vector<BulkItem> add_items(adds.size());
+        std::vector<BulkItem> remove_items(removes.size());
+        parallelForRange(adds.size(), [&adds, &add_items] (std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i != end; ++i) {
+                add_items[i].value = adds[i]->clone();
+                add_items[i].box = add_items[i].value->getBox();
+            }
+        }, threads);
+        for (BulkItem const& item: add_items) growToward(item.box);
+        
+        // The handles are taken up front, the descent only writes the locations
+        std::vector<Handle> handles;
+        handles.reserve(add_items.size());
+        for (BulkItem& item: add_items) {
+            item.handle = m_storage->acquireHandle();
+            handles.push_back(item.handle);
+        }
+        
+        // Removed values are found by the boxes they are indexed with
+        for (std::size_t i = 0; i != removes.size(); ++i) {
+            remove_items[i].value = removes[i];
+            remove_items[i].box = removes[i]->getBox();
+        }
+        auto sort_items = [this, threads] (std::vector<BulkItem>& items) {
+            parallelForRange(items.size(), [this, &items] (std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i != end; ++i) {
+                    items[i].key = NodeType::bulkKey(m_tree_box, items[i].box);
+                }
+            }, threads);
+            parallelSort(items.begin(), items.end(), [] (BulkItem const& lhs, BulkItem const& rhs) {
+                return lhs.key < rhs.key;
+            }, threads);
+        };
+        sort_items(add_items);
+        sort_items(remove_items);
+        
+        typename NodeType::BatchLog log;
+        root().apply(*m_storage, 0, 0, m_tree_box, add_items.begin(), add_items.end(),
+                     remove_items.begin(), remove_items.end(), parallelDepth(threads), log);
+        
+        for (Handle handle: log.released) m_storage->releaseHandle(handle);
+        std::sort(log.touched.begin(), log.touched.end());
+        log.touched.erase(std::unique(log.touched.begin(), log.touched.end()), log.touched.end());
+        for (Index index: log.touched) {
+            if (m_storage->defer_merges) {
+                NodeType::markDirty(*m_storage, index);
+            } else {
+                // A node freed by an earlier merge is a leaf without a parent
+                NodeType& node = m_storage->pool[index];
+                NodeType::mergeUp(*m_storage, node.isLeaf() ? node.parent() : index, Pool::null);
+            }
+        }
+        
+        // Removals of values missing from the tree left no handle
+        m_size = m_size + adds.size() - log.released.size();
+        return handles;
+    }
+    
+    // While merges are deferred, removals and moves only mark the nodes
+    // that lost values, and compact() merges and shrinks them later.
+    // The removals then cost the same whatever the shape of the tree.
+    void deferMerges(bool defer) {
+        m_storage->defer_merges = defer;
+    }
+    
+    // Does up to budget steps of the merges and shrinks deferred so far,
+    // a step is one node. Returns true if nothing is left to do.
+    // Calls with a small budget spread the work over frames.
+    bool compact(std::size_t budget) {
+        return NodeType::compact(*m_storage, budget);
+    }
+    
+    bool contains(Handle handle) const {
+        return m_storage->isValid(handle);
+    }
+    
+    // Value stored for the handle
+    ValPtr const& get(Handle handle) const {
+        assert(contains(handle));
+        typename Storage::Location location = m_storage->locations[handle.id];
+        return m_storage->pool[location.node].values()[location.slot];
+    }
+
+    // Count of values in the tree
+    std::size_t size() const {
+        return m_size;
+    }
+    
+    // Immutable copy of the tree for read-only phases, laid out in flat
+    // arrays. It shares the values with the tree and does not see later changes.
+    LinearQuadTree<T, Real, typename Limits::looseness> freeze() const {
+        return LinearQuadTree<T, Real, typename Limits::looseness>::build(
+            m_tree_box, m_storage->pool, root(), m_storage->pool.size(), m_size
+        );
+    }
+    
+    // Writes the tree to a file that MappedQuadTree<T, Real, looseness>
+    // opens in place, storing getValue() of every value as its payload.
+    // Returns false if the file was not written.
+    bool save(std::string const& path) const {
+        return save(path, [] (Value const& value) { return value.getValue(); });
+    }
+    
+    // Same with the payload given by payload_of(Value const&), such as
+    // an index into the application's own table of the values
+    template <class PayloadOf>
+    bool save(std::string const& path, PayloadOf payload_of) const {
+        return freeze().save(path, payload_of);
     }
     
     std::vector<ValPtr> query(Box const& query_box) {
+        resetQueryCounters();
         std::vector<ValPtr> match_values;
-        m_root_node->query(m_tree_box, query_box, match_values);
+        root().query(m_storage->pool, m_tree_box, query_box, match_values);
         return match_values;
     }
+    
+    // Calls callback(Value const&) for the values intersecting query_box
+    // until it returns false. Nothing is allocated and no reference
+    // counter is touched. Returns false if the callback stopped the query.
+    template <class Callback>
+    bool queryVisit(Box const& query_box, Callback callback) const {
+        resetQueryCounters();
+        if (!query_box.intersects(m_tree_box)) return true;
+        auto visitor = [&callback] (ValPtr const& value) {
+            return callback(static_cast<Value const&>(*value));
+        };
+        return root().visit(m_storage->pool, m_tree_box, query_box, visitor);
+    }
+    
+    // Whether any value intersects query_box, stops at the first one found
+    bool queryAny(Box const& query_box) const {
+        return !queryVisit(query_box, [] (Value const&) { return false; });
+    }
+    
+    // Shape of the tree: counts of nodes by depth and by values kept,
+    // straddlers of the root and the memory used. Walks the whole tree.
+    QuadTreeStats stats() const {
+        QuadTreeStats stats;
+        stats.root_values = root().values().size();
+        stats.bytes = sizeof(*this) + sizeof(Storage) +
+                      m_storage->pool.capacity() * sizeof(NodeType) +
+                      m_storage->locations.capacity() * sizeof(typename Storage::Location) +
+                      m_storage->free_handles.capacity() * sizeof(Handle);
+        collectStats(root(), 0, stats);
+        return stats;
+    }
+    
+    #ifdef QUADTREE_QUERY_COUNTERS
+    // Work of the last query(), queryVisit() or queryAny() of the calling
+    // thread. Other traversals add to the counters of their threads.
+    static QuadTreeQueryCounters const& lastQueryCounters() {
+        return quadTreeQueryCounters();
+    }
+    #endif
+    
+    // Up to k values nearest to the point by the distance to their boxes,
+    // the nearest first. Nodes and values wait in one queue ordered by
+    // the distance to their boxes: a value leaves it only when nothing
+    // closer is left. The k nearest values queued so far bound the answer,
+    // nodes and values beyond the k-th of them are not queued at all.
+    std::vector<ValPtr> nearest(Vector2<Real> const& point, std::size_t k) const {
+        std::vector<ValPtr> found;
+        if (k == 0) return found;
+        
+        std::priority_queue<NearestItem, std::vector<NearestItem>, std::greater<NearestItem>> queue;
+        std::priority_queue<Real> best;
+        auto beyond = [&best, k] (Real distance) {
+            return best.size() == k && !(distance < best.top());
+        };
+        
+        queue.push(NearestItem { m_tree_box.distanceSquared(point), 0, m_tree_box, nullptr });
+        while (!queue.empty()) {
+            NearestItem item = queue.top();
+            queue.pop();
+            if (item.value) {
+                found.push_back(*item.value);
+                if (found.size() == k) break;
+                continue;
+            }
+            
+            NodeType const& node = m_storage->pool[item.node];
+            for (std::size_t i = 0; i != node.values().size(); ++i) {
+                Box box = node.boxes()[i];
+                Real distance = box.distanceSquared(point);
+                if (beyond(distance)) continue;
+                queue.push(NearestItem { distance, 0, box, &node.values()[i] });
+                best.push(distance);
+                if (best.size() > k) best.pop();
+            }
+            if (node.isLeaf()) continue;
+            for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+                Box child_box = item.box.quadrantByIndex(i);
+                Real distance = NodeType::bounds(child_box).distanceSquared(point);
+                if (beyond(distance)) continue;
+                queue.push(NearestItem { distance, node.childIndex(i), child_box, nullptr });
+            }
+        }
+        return found;
+    }
+    
+    // Nearest value hit by the ray origin + t * direction, 0 <= t <= max_t,
+    // null if none. Quadrants are walked in the order the ray enters them,
+    // and the walk stops as soon as no quadrant left can hold a closer hit.
+    RayHit raycast(Vector2<Real> const& origin, Vector2<Real> const& direction,
+                   Real max_t) const {
+        RayHit nearest { nullptr, max_t };
+        auto hit = [&nearest] (ValPtr const& value, Real t, Real& limit) {
+            if (!nearest.value || t < nearest.t) nearest = RayHit { value, t };
+            limit = t;
+        };
+        castRay(origin, direction, max_t, hit);
+        return nearest;
+    }
+    
+    // Every value hit by the ray, the nearest first
+    std::vector<RayHit> raycastAll(Vector2<Real> const& origin, Vector2<Real> const& direction,
+                                   Real max_t) const {
+        std::vector<RayHit> hits;
+        auto hit = [&hits] (ValPtr const& value, Real t, Real&) {
+            hits.push_back(RayHit { value, t });
+        };
+        castRay(origin, direction, max_t, hit);
+        std::stable_sort(hits.begin(), hits.end(), [] (RayHit const& lhs, RayHit const& rhs) {
+            return lhs.t < rhs.t;
+        });
+        return hits;
+    }
+    
+    // Calls callback(Value const&, Value const&) once for every unordered
+    // pair of values whose boxes intersect. Values of sibling subtrees never
+    // intersect, so a value is paired only with the rest of its node and with
+    // its node's descendants. Nodes are handed to the threads independently:
+    // the callback is called from several threads at once.
+    // Loose siblings overlap, a loose tree is joined with itself instead.
+    template <class Callback>
+    void forEachOverlappingPair(Callback callback,
+                                std::size_t threads = hardwareThreads()) const {
+        if (NodeType::isLoose()) {
+            join(*this, [&callback] (Value const& lhs, Value const& rhs) {
+                if (std::less<Value const*>()(&lhs, &rhs)) callback(lhs, rhs);
+            }, threads);
+            return;
+        }
+        
+        std::vector<std::pair<Index, Box>> nodes;
+        collectNodes(0, m_tree_box, nodes);
+        
+        Pool const& pool = m_storage->pool;
+        parallelFor(nodes.size(), [&] (std::size_t k) {
+            NodeType const& node = pool[nodes[k].first];
+            Box const& node_box = nodes[k].second;
+            for (std::size_t i = 0; i != node.values().size(); ++i) {
+                Box box = node.boxes()[i];
+                Value const& value = *node.values()[i];
+                auto pair_in_node = [&] (std::size_t j) {
+                    callback(value, static_cast<Value const&>(*node.values()[j]));
+                    return true;
+                };
+                node.boxes().forEachIntersecting(box, pair_in_node, i + 1, node.values().size());
+                if (node.isLeaf()) continue;
+                
+                auto pair_below = [&] (ValPtr const& other) {
+                    callback(value, static_cast<Value const&>(*other));
+                    return true;
+                };
+                for (int c = 0; c != static_cast<int>(Pool::BlockSize); ++c) {
+                    Box child_box = node_box.quadrantByIndex(c);
+                    if (box.intersects(child_box)) {
+                        node.child(pool, c).visit(pool, child_box, box, pair_below);
+                    }
+                }
+            }
+        }, threads);
+    }
+    
+    // Calls callback(Value const& mine, Value const& other's) once for every
+    // pair of values of the two trees whose boxes intersect. Both trees are
+    // descended together: node pairs at the same depth whose boxes do not
+    // intersect are pruned, the root boxes may differ. A pair is reported at
+    // the node pair of the shallower value: its values against the subtree
+    // of the other node. Node pairs are handed to the threads independently:
+    // the callback is called from several threads at once.
+    template <class OtherLimits, class Callback>
+    void join(QuadTree<T, Real, OtherLimits> const& other, Callback callback,
+              std::size_t threads = hardwareThreads()) const {
+        using OtherNode = typename QuadTree<T, Real, OtherLimits>::NodeType;
+        struct NodePair {
+            Index mine;
+            Box my_box;
+            Index others;
+            Box others_box;
+        };
+        
+        Pool const& pool = m_storage->pool;
+        auto const& other_pool = other.m_storage->pool;
+        std::vector<NodePair> pairs;
+        if (m_tree_box.intersects(other.m_tree_box)) {
+            pairs.push_back(NodePair { 0, m_tree_box, 0, other.m_tree_box });
+        }
+        for (std::size_t k = 0; k != pairs.size(); ++k) {
+            NodePair pair = pairs[k];
+            NodeType const& mine = pool[pair.mine];
+            OtherNode const& others = other_pool[pair.others];
+            if (mine.isLeaf() || others.isLeaf()) continue;
+            for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+                Box my_child_box = pair.my_box.quadrantByIndex(i);
+                for (int j = 0; j != static_cast<int>(Pool::BlockSize); ++j) {
+                    Box others_child_box = pair.others_box.quadrantByIndex(j);
+                    if (NodeType::bounds(my_child_box).intersects(OtherNode::bounds(others_child_box))) {
+                        pairs.push_back(NodePair {
+                            mine.childIndex(i), my_child_box, others.childIndex(j), others_child_box
+                        });
+                    }
+                }
+            }
+        }
+        
+        parallelFor(pairs.size(), [&] (std::size_t k) {
+            NodePair const& pair = pairs[k];
+            NodeType const& mine = pool[pair.mine];
+            OtherNode const& others = other_pool[pair.others];
+            
+            // My values against the whole subtree of the other node
+            for (std::size_t i = 0; i != mine.values().size(); ++i) {
+                Box box = mine.boxes()[i];
+                if (!box.intersects(OtherNode::bounds(pair.others_box))) continue;
+                Value const& value = *mine.values()[i];
+                auto pair_with = [&] (ValPtr const& other_value) {
+                    callback(value, static_cast<Value const&>(*other_value));
+                    return true;
+                };
+                others.visit(other_pool, pair.others_box, box, pair_with);
+            }
+            if (mine.isLeaf()) return;
+            
+            // The other node's values against my subtree below this node
+            for (std::size_t i = 0; i != others.values().size(); ++i) {
+                Box box = others.boxes()[i];
+                Value const& other_value = *others.values()[i];
+                auto pair_with = [&] (ValPtr const& value) {
+                    callback(static_cast<Value const&>(*value), other_value);
+                    return true;
+                };
+                for (int c = 0; c != static_cast<int>(Pool::BlockSize); ++c) {
+                    Box child_box = pair.my_box.quadrantByIndex(c);
+                    if (box.intersects(NodeType::bounds(child_box))) {
+                        mine.child(pool, c).visit(pool, child_box, box, pair_with);
+                    }
+                }
+            }
+        }, threads);
+    }
+    
+    // Answers independent queries on worker threads. The tree must not be
+    // modified meanwhile. The queries are walked twice: the first pass counts
+    // the matches, so the second one fills a single preallocated buffer.
+    QueryBatchResult<ValPtr> queryBatch(Box const* query_boxes, std::size_t count,
+                                        std::size_t threads = hardwareThreads()) const {
+        QueryBatchResult<ValPtr> result;
+        result.offsets.assign(count + 1, 0);
+        
+        parallelFor(count, [&] (std::size_t i) {
+            std::size_t matches = 0;
+            auto counter = [&matches] (ValPtr const&) { ++matches; return true; };
+            if (query_boxes[i].intersects(m_tree_box)) {
+                root().visit(m_storage->pool, m_tree_box, query_boxes[i], counter);
+            }
+            result.offsets[i + 1] = matches;
+        }, threads);
+        
+        for (std::size_t i = 0; i != count; ++i) {
+            result.offsets[i + 1] += result.offsets[i];
+        }
+        result.values.resize(result.offsets[count]);
+        
+        parallelFor(count, [&] (std::size_t i) {
+            ValPtr* out = result.values.data() + result.offsets[i];
+            auto writer = [&out] (ValPtr const& value) { *out++ = value; return true; };
+            if (query_boxes[i].intersects(m_tree_box)) {
+                root().visit(m_storage->pool, m_tree_box, query_boxes[i], writer);
+            }
+        }, threads);
+        
+        return result;
+    }
+    
+    QueryBatchResult<ValPtr> queryBatch(std::vector<Box> const& query_boxes,
+                                        std::size_t threads = hardwareThreads()) const {
+        return queryBatch(query_boxes.data(), query_boxes.size(), threads);
+    }
   
+  private:
+    template <class, class, class>
+    friend class QuadTree;
+    
+    using Index = typename NodeType::Index;
+    using BulkItem = typename NodeType::BulkItem;
+    
+    // Lays the items out as the whole tree, they keep their handles
+    void build(std::vector<BulkItem>& items, std::size_t threads) {
+        parallelForRange(items.size(), [this, &items] (std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i != end; ++i) {
+                assert(m_tree_box.contains(items[i].box));
+                items[i].key = NodeType::bulkKey(m_tree_box, items[i].box);
+            }
+        }, threads);
+        
+        parallelSort(items.begin(), items.end(), [] (BulkItem const& lhs, BulkItem const& rhs) {
+            return lhs.key < rhs.key;
+        }, threads);
+        
+        // The nodes of the old layout are gone with their dirty flags,
+        // the new one is built merged
+        m_storage->pool.clear();
+        m_storage->dirty.clear();
+        m_storage->pool.allocateBlock();
+        root().build(*m_storage, 0, 0, m_tree_box, items.begin(), items.end(), parallelDepth(threads));
+    }
+    
+    // Enough levels done in parallel to give every thread a subtree
+    static std::size_t parallelDepth(std::size_t threads) {
+        std::size_t parallel_depth = 0;
+        for (std::size_t subtrees = 1; subtrees < threads; subtrees *= 4) {
+            ++parallel_depth;
+        }
+        return parallel_depth;
+    }
+    
+    // The box widened so its edges are multiples of a power of two unit, with
+    // the extent of the box below unit * 2^(digits / 2). Doublings keep the
+    // edges multiples of the unit, so they stay exact until the extent grows
+    // 2^(digits / 2 - 1) times, 2048 times for float: the grown box
+    // reproduces the old one as its quadrant bit for bit.
+    static Box growableBox(Box const& box) {
+        if (!std::is_floating_point<Real>::value) return box;
+        Real extent = std::max({ std::abs(box.left), std::abs(box.top),
+                                 std::abs(box.getRight()), std::abs(box.getBottom()) });
+        int exponent = 0;
+        std::frexp(extent, &exponent);
+        Real unit = std::ldexp(Real(1), exponent - (std::numeric_limits<Real>::digits + 1) / 2);
+        Real left = std::floor(box.left / unit) * unit;
+        Real top = std::floor(box.top / unit) * unit;
+        Real right = std::ceil(box.getRight() / unit) * unit;
+        Real bottom = std::ceil(box.getBottom() / unit) * unit;
+        return Box(left, top, right - left, bottom - top);
+    }
+    
+    // Tree box doubled toward the box, the old tree box is its quadrant
+    Box doubledToward(Box const& box, int& quadrant) const {
+        bool west = box.left < m_tree_box.left;
+        bool north = box.top < m_tree_box.top;
+        quadrant = (west ? 1 : 0) + (north ? 2 : 0);
+        return Box(west ? m_tree_box.left - m_tree_box.width : m_tree_box.left,
+                   north ? m_tree_box.top - m_tree_box.height : m_tree_box.top,
+                   m_tree_box.width * 2, m_tree_box.height * 2);
+    }
+    
+    // Node or value waiting in the queue of nearest()
+    struct NearestItem {
+        Real distance;
+        Index node;
+        Box box;
+        // Null for a node
+        ValPtr const* value;
+        
+        bool operator>(NearestItem const& other) const {
+            return distance > other.distance;
+        }
+    };
+
+    // Deepest node on the path from the root to the node whose box contains
+    // box, with its box and depth. Containment only shrinks down the path.
+    Index deepestContaining(Index node, Box const& box, Box& node_box, std::size_t& depth) const {
+        Index parent = m_storage->pool[node].parent();
+        if (parent == Pool::null) {
+            node_box = m_tree_box;
+            depth = 0;
+            return node;
+        }
+        
+        Index found = deepestContaining(parent, box, node_box, depth);
+        if (found != parent) return found;
+        
+        // The route of add(): a loose child may hold the box off the route
+        int quadrant = static_cast<int>(node - m_storage->pool[parent].childIndex(0));
+        if (NodeType::childFor(node_box, box) != quadrant) return parent;
+        node_box = node_box.quadrantByIndex(quadrant);
+        ++depth;
+        return node;
+    }
+    
+    // Calls hit(value, t, limit) for the values the ray enters at t <= limit,
+    // hit() may lower the limit to cut the rest of the walk
+    template <class Hit>
+    void castRay(Vector2<Real> const& origin, Vector2<Real> const& direction,
+                 Real limit, Hit& hit) const {
+        Real t = 0;
+        if (m_tree_box.rayEntry(origin, direction, limit, t)) {
+            castRay(0, m_tree_box, origin, direction, limit, hit);
+        }
+    }
+    
+    template <class Hit>
+    void castRay(Index index, Box const& node_box, Vector2<Real> const& origin,
+                 Vector2<Real> const& direction, Real& limit, Hit& hit) const {
+        NodeType const& node = m_storage->pool[index];
+        for (std::size_t i = 0; i != node.values().size(); ++i) {
+            Real t = 0;
+            if (node.boxes()[i].rayEntry(origin, direction, limit, t)) {
+                hit(node.values()[i], t, limit);
+            }
+        }
+        if (node.isLeaf()) return;
+        
+        // Children the ray enters, by the entry point
+        std::array<std::pair<Real, int>, Pool::BlockSize> entered;
+        std::size_t count = 0;
+        for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+            Real t = 0;
+            if (NodeType::bounds(node_box.quadrantByIndex(i)).rayEntry(origin, direction, limit, t)) {
+                entered[count++] = std::make_pair(t, i);
+            }
+        }
+        // Insertion sort of at most four entries
+        for (std::size_t k = 1; k < count; ++k) {
+            std::pair<Real, int> entry = entered[k];
+            std::size_t j = k;
+            for (; j != 0 && entry < entered[j - 1]; --j) entered[j] = entered[j - 1];
+            entered[j] = entry;
+        }
+        
+        for (std::size_t k = 0; k != count; ++k) {
+            if (entered[k].first > limit) break;
+            int i = entered[k].second;
+            castRay(node.childIndex(i), node_box.quadrantByIndex(i), origin, direction, limit, hit);
+        }
+    }
+    
+    // Every node of the subtree with its box
+    void collectNodes(Index index, Box const& node_box,
+                      std::vector<std::pair<Index, Box>>& nodes) const {
+        nodes.emplace_back(index, node_box);
+        NodeType const& node = m_storage->pool[index];
+        if (node.isLeaf()) return;
+        for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+            collectNodes(node.childIndex(i), node_box.quadrantByIndex(i), nodes);
+        }
+    }
+    
+    static void resetQueryCounters() {
+        #ifdef QUADTREE_QUERY_COUNTERS
+        quadTreeQueryCounters() = QuadTreeQueryCounters();
+        #endif
+    }
+    
+    void collectStats(NodeType const& node, std::size_t depth, QuadTreeStats& stats) const {
+        auto bump = [] (std::vector<std::size_t>& histogram, std::size_t i) {
+            if (histogram.size() <= i) histogram.resize(i + 1);
+            ++histogram[i];
+        };
+        ++stats.nodes;
+        bump(stats.depth_histogram, depth);
+        bump(stats.values_histogram, node.values().size());
+        stats.bytes += node.bytes();
+        if (node.isLeaf()) {
+            ++stats.leaves;
+            if (node.values().size() > NodeType::getMaxValuesSize()) ++stats.overflowing_leaves;
+            return;
+        }
+        for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+            collectStats(node.child(m_storage->pool, i), depth + 1, stats);
+        }
+    }
+    
+    NodeType& root() {
+        return m_storage->pool[0];
+    }
+    
+    NodeType const& root() const {
+        return m_storage->pool[0];
+    }
+    
   private:
     Box m_tree_box;
-    NodePtr m_root_node;
+    // Owns every node of the tree and the handle locations
+    std::unique_ptr<Storage> m_storage;
+    std::size_t m_size = 0;
 };
 
+// Pairs of intersecting values of two trees, see QuadTree::join()
+template <class T, class Real, class LimitsA, class LimitsB, class Callback>
+void spatialJoin(QuadTree<T, Real, LimitsA> const& tree_a, QuadTree<T, Real, LimitsB> const& tree_b,
+                 Callback callback, std::size_t threads = hardwareThreads()) {
+    tree_a.join(tree_b, callback, threads);
+}
+
 #endif //QUADTREE_QUADTREE_HPP
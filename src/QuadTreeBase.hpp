@@ -30,7 +30,7 @@ template <class ValueT, class BoxType = float>
 struct ValueInBox: virtual public ClonableBase<ValueInBox<ValueT, BoxType>> {
     using Value = ValueInBox<ValueT, BoxType>;
     using Ptr = std::shared_ptr<Value>;
-    using Box = Box<BoxType>;
+    using Box = ::Box<BoxType>;
     
     virtual ~ValueInBox() = default;
     
@@ -0,0 +1,116 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_QUADTREEFILE_HPP
+#define QUADTREE_QUADTREEFILE_HPP
+
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define QUADTREE_HAS_MMAP
+#endif
+
+constexpr std::uint32_t QuadTreeFileVersion = 1;
+constexpr std::uint32_t QuadTreeFileByteOrder = 0x01020304u;
+constexpr std::uint64_t QuadTreeFileAlignment = 64;
+
+// Snapshot file of a LinearQuadTree, see LinearQuadTree::save() and
+// MappedQuadTree. The sections follow the header at offsets from the start
+// of the file, aligned to QuadTreeFileAlignment, so the file works at any address:
+//   nodes:    node_count LinearQuadTreeNode
+//   boxes:    four lanes of value_count Real, lefts, tops, widths, heights
+//   payloads: value_count opaque payloads of payload_size bytes
+// Numbers are in the byte order of the writer, byte_order tells it.
+struct QuadTreeFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t real_size;
+    std::uint32_t payload_size;
+    std::int64_t looseness_num;
+    std::int64_t looseness_den;
+    // Left, top, width and height
+    double tree_box[4];
+    std::uint64_t node_count;
+    std::uint64_t value_count;
+    std::uint64_t nodes_offset;
+    std::uint64_t boxes_offset;
+    std::uint64_t payloads_offset;
+    std::uint64_t file_size;
+    
+    static char const* expectedMagic() {
+        return "QTREEMAP";
+    }
+    
+    static std::uint64_t aligned(std::uint64_t offset) {
+        return (offset + QuadTreeFileAlignment - 1) / QuadTreeFileAlignment * QuadTreeFileAlignment;
+    }
+};
+
+// Read-only content of a file, mapped to memory where the system allows it,
+// so processes opening the same file share its pages. Elsewhere the file is
+// read into memory. Empty if the file cannot be opened.
+class MappedFile {
+  public:
+    explicit MappedFile(std::string const& path) {
+        #ifdef QUADTREE_HAS_MMAP
+        int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0) return;
+        struct stat status;
+        if (::fstat(file, &status) == 0 && status.st_size > 0) {
+            void* data = ::mmap(nullptr, static_cast<std::size_t>(status.st_size),
+                                PROT_READ, MAP_SHARED, file, 0);
+            if (data != MAP_FAILED) {
+                m_data = static_cast<char const*>(data);
+                m_size = static_cast<std::size_t>(status.st_size);
+            }
+        }
+        ::close(file);
+        #else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) return;
+        std::size_t size = static_cast<std::size_t>(file.tellg());
+        m_buffer.reset(new char[size]);
+        file.seekg(0);
+        if (file.read(m_buffer.get(), static_cast<std::streamsize>(size))) {
+            m_data = m_buffer.get();
+            m_size = size;
+        }
+        #endif
+    }
+    
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+    
+    ~MappedFile() {
+        #ifdef QUADTREE_HAS_MMAP
+        if (m_data) ::munmap(const_cast<char*>(m_data), m_size);
+        #endif
+    }
+    
+    char const* data() const {
+        return m_data;
+    }
+    
+    std::size_t size() const {
+        return m_size;
+    }
+    
+  private:
+    char const* m_data = nullptr;
+    std::size_t m_size = 0;
+    #ifndef QUADTREE_HAS_MMAP
+    std::unique_ptr<char[]> m_buffer;
+    #endif
+};
+
+#endif // QUADTREE_QUADTREEFILE_HPP
@@ -0,0 +1,47 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_QUADTREELIMITS_HPP
+#define QUADTREE_QUADTREELIMITS_HPP
+
+#include <ratio>
+#include <cstddef>
+
+// Shape of the tree fixed at compile time: a leaf above MaxDepth is split
+// when it exceeds MaxValues. Dense data wants bigger leaves, sparse data
+// deeper trees. The path keys of bulkLoad hold at most 21 levels.
+//
+// Looseness above 1 makes a loose quadtree: a child holds the values within
+// its quadrant scaled by Looseness around the quadrant center, and a value
+// goes to the child of its center. Values crossing the axes of a node sink
+// into the children instead of piling up in it, queries test the scaled boxes.
+//
+// Children merge back into their parent when they hold at most MergeValues
+// values together with it. MergeValues below MaxValues leaves a gap between
+// the split and the merge, so adds and removes around the threshold
+// do not split and merge the same node over and over.
+template <std::size_t MaxValues = 16, std::size_t MaxDepth = 8, class Looseness = std::ratio<1>,
+          std::size_t MergeValues = MaxValues>
+struct QuadTreeLimits {
+    static_assert(MaxValues > 0, "A leaf holds at least one value");
+    static_assert(MaxDepth <= 21, "Bulk load keys hold 21 levels");
+    static_assert(Looseness::num >= Looseness::den, "Children are never tighter than quadrants");
+    static_assert(MergeValues <= MaxValues, "A merged node is never split again at once");
+    
+    static constexpr std::size_t max_values = MaxValues;
+    static constexpr std::size_t max_depth = MaxDepth;
+    static constexpr std::size_t merge_values = MergeValues;
+    using looseness = Looseness;
+};
+
+template <std::size_t MaxValues, std::size_t MaxDepth, class Looseness, std::size_t MergeValues>
+constexpr std::size_t QuadTreeLimits<MaxValues, MaxDepth, Looseness, MergeValues>::max_values;
+
+template <std::size_t MaxValues, std::size_t MaxDepth, class Looseness, std::size_t MergeValues>
+constexpr std::size_t QuadTreeLimits<MaxValues, MaxDepth, Looseness, MergeValues>::max_depth;
+
+template <std::size_t MaxValues, std::size_t MaxDepth, class Looseness, std::size_t MergeValues>
+constexpr std::size_t QuadTreeLimits<MaxValues, MaxDepth, Looseness, MergeValues>::merge_values;
+
+#endif // QUADTREE_QUADTREELIMITS_HPP
@@ -5,10 +5,395 @@
 #ifndef QUADTREE_QUADTREEPARALLEL_HPP
 #define QUADTREE_QUADTREEPARALLEL_HPP
 
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <algorithm>
 #include "QuadTreeBase.hpp"
+#include "QuadTreeLimits.hpp"
 
+// Readers-writer spin lock. A writer announces itself first, so a stream
+// of readers cannot starve it, then waits for the active readers to leave.
+class SharedSpinMutex {
+  public:
+    void lock() {
+        bool expected = false;
+        while (!m_writer.compare_exchange_weak(expected, true)) {
+            expected = false;
+            std::this_thread::yield();
+        }
+        while (m_readers.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+    
+    void unlock() {
+        m_writer.store(false);
+    }
+    
+    void lock_shared() {
+        for (;;) {
+            while (m_writer.load()) {
+                std::this_thread::yield();
+            }
+            m_readers.fetch_add(1);
+            if (!m_writer.load()) return;
+            m_readers.fetch_sub(1);
+        }
+    }
+    
+    void unlock_shared() {
+        m_readers.fetch_sub(1);
+    }
+    
+  private:
+    std::atomic<bool> m_writer { false };
+    std::atomic<int> m_readers { 0 };
+};
 
+// SharedSpinMutex whose readers count in stripes of their own: a thread
+// takes the next stripe on its first shared lock and keeps it. Up to
+// Stripes threads take a shared lock writing no cache line another one
+// reads, so the readers of a hot node scale with cores. A writer waits
+// for every stripe to empty, so the exclusive lock costs more.
+class StripedSharedSpinMutex {
+  public:
+    static constexpr std::size_t Stripes = 16;
+    
+    void lock() {
+        bool expected = false;
+        while (!m_writer.compare_exchange_weak(expected, true)) {
+            expected = false;
+            std::this_thread::yield();
+        }
+        for (Stripe const& stripe: m_stripes) {
+            while (stripe.readers.load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    
+    void unlock() {
+        m_writer.store(false);
+    }
+    
+    void lock_shared() {
+        std::atomic<int>& readers = m_stripes[stripeIndex()].readers;
+        for (;;) {
+            while (m_writer.load()) {
+                std::this_thread::yield();
+            }
+            readers.fetch_add(1);
+            if (!m_writer.load()) return;
+            readers.fetch_sub(1);
+        }
+    }
+    
+    void unlock_shared() {
+        m_stripes[stripeIndex()].readers.fetch_sub(1);
+    }
+    
+  private:
+    // Two cache lines per stripe: the counters never share a line
+    // whatever the alignment of the mutex
+    struct Stripe {
+        std::atomic<int> readers { 0 };
+        char padding[128 - sizeof(std::atomic<int>)];
+    };
+    
+    // Same for every mutex, so unlock_shared finds the stripe of lock_shared
+    static std::size_t stripeIndex() {
+        static std::atomic<std::size_t> next_index { 0 };
+        static thread_local std::size_t const index = next_index.fetch_add(1) % Stripes;
+        return index;
+    }
+    
+    std::atomic<bool> m_writer { false };
+    char m_padding[128 - sizeof(std::atomic<bool>)];
+    std::array<Stripe, Stripes> m_stripes;
+};
 
+template <class Mutex>
+class SharedLockGuard {
+  public:
+    explicit SharedLockGuard(Mutex& mutex)
+    : m_mutex(mutex)
+    {
+        m_mutex.lock_shared();
+    }
+    
+    ~SharedLockGuard() {
+        m_mutex.unlock_shared();
+    }
+    
+    SharedLockGuard(SharedLockGuard const&) = delete;
+    SharedLockGuard& operator=(SharedLockGuard const&) = delete;
+    
+  private:
+    Mutex& m_mutex;
+};
+
+// Locking protocol:
+//  * Every thread holds a shared lock on each node of the path from the
+//    root to the node it currently works with.
+//  * A node's m_values and m_children change only under its exclusive lock.
+//  * Merge replaces the children of a node, so it is done under the
+//    exclusive lock of that node: no other thread can be inside the children.
+// Locks are always taken top-down, so there is no deadlock, and readers of
+// different subtrees never wait for each other or for a writer.
+//
+// Every operation passes the root, so QuadTreeParallel gives it
+// a StripedSharedSpinMutex; the children lock a SharedSpinMutex.
+template <class T, class Real, class Limits, class Mutex = SharedSpinMutex>
+class ParallelNode {
+  public:
+    using Child = ParallelNode<T, Real, Limits>;
+    using Ptr = std::unique_ptr<Child>;
+    using ValPtr = std::shared_ptr<ValueInBox<T, Real>>;
+    using Box = ::Box<Real>;
+    using Quadrants = typename Box::Quadrants;
+    
+    static_assert(Limits::looseness::num == Limits::looseness::den,
+                  "ParallelNode keeps values in the plain quadrants");
+    
+  public:
+    bool isLeaf() const {
+        return m_children[0] == nullptr;
+    }
+    
+    static constexpr size_t getMaxDepth() {
+        return Limits::max_depth;
+    }
+    
+    static constexpr size_t getMaxValuesSize() {
+        return Limits::max_values;
+    }
+    
+    static constexpr size_t getMergeValuesSize() {
+        return Limits::merge_values;
+    }
+    
+    // Caller holds a shared lock on the parent node
+    void add(std::size_t depth, Box const& node_box, ValPtr const& value) {
+        assert(node_box.contains(value->getBox()));
+        {
+            SharedLockGuard<Mutex> lock(m_mutex);
+            if (!isLeaf()) {
+                Quadrants i = node_box.quadrantIndex(value->getBox());
+                if (i != Quadrants::NEITHER_ONE_QUADRANT) {
+                    child(i)->add(depth + 1, node_box.quadrantByIndex(i), value);
+                    return;
+                }
+            }
+        }
+        
+        // The value stays in this node: the node may change since
+        // the shared lock was released, so the checks are repeated
+        std::lock_guard<Mutex> lock(m_mutex);
+        addLocked(depth, node_box, value);
+    }
+    
+    // Returns true if the value was removed from a leaf,
+    // so the parent should try to merge
+    bool remove(Box const& node_box, ValPtr const& value) {
+        assert(node_box.contains(value->getBox()));
+        bool removed_from_child_leaf = false;
+        {
+            SharedLockGuard<Mutex> lock(m_mutex);
+            if (!isLeaf()) {
+                Quadrants i = node_box.quadrantIndex(value->getBox());
+                if (i != Quadrants::NEITHER_ONE_QUADRANT) {
+                    removed_from_child_leaf =
+                        child(i)->remove(node_box.quadrantByIndex(i), value);
+                    if (!removed_from_child_leaf) return false;
+                }
+            }
+        }
+        
+        // Merge and removal from this node need the exclusive lock
+        std::lock_guard<Mutex> lock(m_mutex);
+        if (removed_from_child_leaf) {
+            tryMerge();
+            return false;
+        }
+        return removeLocked(node_box, value);
+    }
+    
+    void query(Box const& node_box, Box const& query_box,
+               std::vector<ValPtr>& match_values) {
+        assert(query_box.intersects(node_box));
+        SharedLockGuard<Mutex> lock(m_mutex);
+        for (ValPtr& value: m_values) {
+            if(query_box.intersects(value->getBox())) {
+                match_values.push_back(value);
+            }
+        }
+        
+        if(!isLeaf()) {
+            for (int i = 0; i != static_cast<int>(m_children.size()); ++i) {
+                Box child_box = node_box.quadrantByIndex(i);
+                if(query_box.intersects(child_box)) {
+                    child(i)->query(child_box, query_box, match_values);
+                }
+            }
+        }
+    }
+    
+  private:
+    Ptr& child(int i) {
+        return m_children[static_cast<std::size_t>(i)];
+    }
+    
+    // Node::add with the exclusive lock of this node held
+    void addLocked(std::size_t depth, Box const& node_box, ValPtr const& value) {
+        if (isLeaf()) {
+            if(depth >= getMaxDepth() || m_values.size() < getMaxValuesSize()) {
+                push(value);
+            } else {
+                split(node_box);
+                addLocked(depth, node_box, value);
+            }
+        } else {
+            Quadrants i = node_box.quadrantIndex(value->getBox());
+            if(i != Quadrants::NEITHER_ONE_QUADRANT) {
+                // Another writer has split this node meanwhile
+                child(i)->add(depth + 1, node_box.quadrantByIndex(i), value);
+            } else {
+                push(value);
+            }
+        }
+    }
+    
+    // Node::remove with the exclusive lock of this node held
+    bool removeLocked(Box const& node_box, ValPtr const& value) {
+        if (isLeaf()) {
+            remove(value);
+            return true;
+        }
+        
+        Quadrants i = node_box.quadrantIndex(value->getBox());
+        if (i != Quadrants::NEITHER_ONE_QUADRANT) {
+            // Another writer has split this node meanwhile
+            if (child(i)->remove(node_box.quadrantByIndex(i), value)) {
+                tryMerge();
+            }
+        }
+        else {
+            remove(value);
+        }
+        return false;
+    }
+    
+    void push(ValPtr const& value) {
+        m_values.push_back(value->clone());
+    }
+    
+    void split(Box const& node_box) {
+        assert(isLeaf() && "Only leaves can be split");
+        for (Ptr& child: m_children) {
+            child.reset(new Child());
+        }
+        
+        std::vector<ValPtr> new_this_values;
+        for (ValPtr& value: m_values) {
+            Quadrants i = node_box.quadrantIndex(value->getBox());
+            if(i != Quadrants::NEITHER_ONE_QUADRANT) {
+                child(i)->m_values.push_back(std::move(value));
+            }
+            else {
+                new_this_values.push_back(std::move(value));
+            }
+        }
+        m_values = std::move(new_this_values);
+    }
+    
+    void remove(ValPtr const& value) {
+        auto found = std::find_if(
+            m_values.begin(), m_values.end(),
+            [&value] (ValPtr const& rhs) {
+                return *value == *rhs;
+            }
+        );
+        assert(found != m_values.end() &&
+               "Trying to remove a value that is not present in the node");
+        
+        *found = std::move(m_values.back());
+        m_values.pop_back();
+    }
+    
+    // Exclusive lock of this node is held, so no thread is inside the children
+    void tryMerge() {
+        // Another writer may have merged this node already
+        if (isLeaf()) return;
+        
+        size_t count_child_values = m_values.size();
+        for (Ptr const& child: m_children) {
+            if (!child->isLeaf()) return;
+            count_child_values += child->m_values.size();
+        }
+        
+        if (count_child_values <= getMergeValuesSize()) {
+            m_values.reserve(count_child_values);
+            for (Ptr& child: m_children) {
+                for (ValPtr& value: child->m_values) {
+                    m_values.push_back(std::move(value));
+                }
+            }
+            
+            for (Ptr& child: m_children) {
+                child.reset();
+            }
+        }
+    }
+    
+  private:
+    template <class, class, class, class> friend class ParallelNode;
+    
+    Mutex m_mutex;
+    std::array<Ptr, 4> m_children;
+    std::vector<ValPtr> m_values = { };
+};
+
+// Thread-safe QuadTree: any number of threads may call add, remove
+// and query at the same time. The root node is never replaced,
+// so it needs no parent lock.
+//
+// Every operation takes a shared lock of the root, which is striped:
+// concurrent queries write no shared cache line at the root.
+template<class T, class Real = float, class Limits = QuadTreeLimits<>>
+class QuadTreeParallel: public QuadTreeBase<T, Real> {
+  private:
+    using NodeType = ParallelNode<T, Real, Limits, StripedSharedSpinMutex>;
+    using NodePtr = std::unique_ptr<NodeType>;
+    using Box = typename QuadTreeBase<T, Real>::Box;
+    using ValPtr = typename QuadTreeBase<T, Real>::ValPtr;
+    
+  public:
+    explicit QuadTreeParallel(Box tree_box)
+    : m_tree_box(tree_box)
+    , m_root_node(new NodeType())
+    { }
+    
+    void add(ValPtr const& value) override {
+        m_root_node->add(0, m_tree_box, value);
+    }
+    
+    void remove(ValPtr const& value) override {
+        m_root_node->remove(m_tree_box, value);
+    }
+    
+    std::vector<ValPtr> query(Box const& query_box) override {
+        std::vector<ValPtr> match_values;
+        if (query_box.intersects(m_tree_box)) {
+            m_root_node->query(m_tree_box, query_box, match_values);
+        }
+        return match_values;
+    }
+    
+  private:
+    Box const m_tree_box;
+    NodePtr m_root_node;
+};
 
 #endif // QUADTREE_QUADTREEPARALLEL_HPP
@@ -0,0 +1,50 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_QUADTREESTATS_HPP
+#define QUADTREE_QUADTREESTATS_HPP
+
+#include <vector>
+#include <cstddef>
+
+// Shape of a QuadTree, see QuadTree::stats()
+struct QuadTreeStats {
+    std::size_t nodes = 0;
+    std::size_t leaves = 0;
+    // Nodes at the depth i
+    std::vector<std::size_t> depth_histogram;
+    // Nodes keeping i values. Only leaves at the max depth keep more
+    // than the max values count, the tail past it shows them.
+    std::vector<std::size_t> values_histogram;
+    // Leaves keeping more values than the max values count
+    std::size_t overflowing_leaves = 0;
+    // Values straddling the axes of the root, every query tests them
+    std::size_t root_values = 0;
+    // Heap bytes of the nodes, their arrays and the handle locations,
+    // the values themselves excluded
+    std::size_t bytes = 0;
+};
+
+// Work of the last query of the calling thread, see QuadTree::lastQueryCounters().
+// Counted only when QUADTREE_QUERY_COUNTERS is defined, otherwise
+// the counting is compiled out.
+struct QuadTreeQueryCounters {
+    std::size_t nodes_visited = 0;
+    // Value boxes and child cells tested against the query box
+    std::size_t boxes_tested = 0;
+    std::size_t matches = 0;
+};
+
+#ifdef QUADTREE_QUERY_COUNTERS
+inline QuadTreeQueryCounters& quadTreeQueryCounters() {
+    static thread_local QuadTreeQueryCounters counters;
+    return counters;
+}
+
+#define QUADTREE_COUNT_QUERY(counter, count) (quadTreeQueryCounters().counter += (count))
+#else
+#define QUADTREE_COUNT_QUERY(counter, count) ((void)0)
+#endif
+
+#endif // QUADTREE_QUADTREESTATS_HPP
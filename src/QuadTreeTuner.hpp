@@ -0,0 +1,123 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_QUADTREETUNER_HPP
+#define QUADTREE_QUADTREETUNER_HPP
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "QuadTree.hpp"
+
+// Recorded sequence of tree operations to be replayed against
+// differently shaped trees
+template <class T, class Real = float>
+class QuadTreeWorkload {
+  public:
+    using Value = typename ValueInBox<T, Real>::Value;
+    using ValPtr = typename Value::Ptr;
+    using Box = typename Value::Box;
+    
+    enum class Kind {
+        ADD,
+        REMOVE,
+        QUERY
+    };
+    
+    // The value of ADD and REMOVE, the box of QUERY
+    struct Operation {
+        Kind kind;
+        ValPtr value;
+        Box box;
+    };
+    
+  public:
+    explicit QuadTreeWorkload(Box tree_box)
+    : m_tree_box(tree_box)
+    { }
+    
+    void recordAdd(ValPtr const& value) {
+        m_operations.push_back(Operation { Kind::ADD, value, Box() });
+    }
+    
+    void recordRemove(ValPtr const& value) {
+        m_operations.push_back(Operation { Kind::REMOVE, value, Box() });
+    }
+    
+    void recordQuery(Box const& query_box) {
+        m_operations.push_back(Operation { Kind::QUERY, nullptr, query_box });
+    }
+    
+    // Runs the operations on the tree, returns the count of values found
+    template <class Tree>
+    std::size_t replay(Tree& tree) const {
+        std::size_t matches = 0;
+        for (Operation const& operation: m_operations) {
+            switch (operation.kind) {
+                case Kind::ADD: tree.add(operation.value); break;
+                case Kind::REMOVE: tree.remove(operation.value); break;
+                case Kind::QUERY:
+                    tree.queryVisit(operation.box, [&matches] (Value const&) {
+                        ++matches;
+                        return true;
+                    });
+                    break;
+            }
+        }
+        return matches;
+    }
+    
+    Box const& treeBox() const {
+        return m_tree_box;
+    }
+    
+    std::vector<Operation> const& operations() const {
+        return m_operations;
+    }
+    
+  private:
+    Box m_tree_box;
+    std::vector<Operation> m_operations;
+};
+
+struct QuadTreeTuneResult {
+    std::size_t max_values;
+    std::size_t max_depth;
+    // Best time of the replays
+    double seconds;
+    std::size_t matches;
+};
+
+template <class T, class Real, class Limits>
+QuadTreeTuneResult measureQuadTree(QuadTreeWorkload<T, Real> const& workload,
+                                   std::size_t repeats) {
+    using Clock = std::chrono::steady_clock;
+    QuadTreeTuneResult result { Limits::max_values, Limits::max_depth, 0, 0 };
+    for (std::size_t repeat = 0; repeat != repeats; ++repeat) {
+        QuadTree<T, Real, Limits> tree(workload.treeBox());
+        Clock::time_point start = Clock::now();
+        result.matches = workload.replay(tree);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (repeat == 0 || seconds < result.seconds) result.seconds = seconds;
+    }
+    return result;
+}
+
+// Replays the workload on a fresh QuadTree of every given QuadTreeLimits
+// and returns the results from the fastest one:
+//     tuneQuadTree<T, float, QuadTreeLimits<8, 10>, QuadTreeLimits<64, 6>>(workload)
+template <class T, class Real, class... LimitsList>
+std::vector<QuadTreeTuneResult> tuneQuadTree(QuadTreeWorkload<T, Real> const& workload,
+                                             std::size_t repeats = 3) {
+    std::vector<QuadTreeTuneResult> results {
+        measureQuadTree<T, Real, LimitsList>(workload, repeats)...
+    };
+    std::sort(results.begin(), results.end(),
+              [] (QuadTreeTuneResult const& lhs, QuadTreeTuneResult const& rhs) {
+                  return lhs.seconds < rhs.seconds;
+              });
+    return results;
+}
+
+#endif // QUADTREE_QUADTREETUNER_HPP
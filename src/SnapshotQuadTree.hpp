@@ -0,0 +1,414 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_SNAPSHOTQUADTREE_HPP
+#define QUADTREE_SNAPSHOTQUADTREE_HPP
+
+#include <array>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include "QuadTree.hpp"
+
+// Node of SnapshotQuadTree. Immutable once a version holding it is
+// published, only the version that made it changes it in place.
+template <class T, class Real>
+struct SnapshotNode {
+    using ValPtr = std::shared_ptr<ValueInBox<T, Real>>;
+    
+    // Null for a leaf
+    std::array<SnapshotNode*, 4> children {{ nullptr, nullptr, nullptr, nullptr }};
+    std::vector<ValPtr> values;
+    BoxArray<Real> boxes;
+    // Values of the subtree
+    std::size_t count = 0;
+    std::uint64_t version = 0;
+    
+    bool isLeaf() const {
+        return children[0] == nullptr;
+    }
+};
+
+// Epoch pinned by a reader, idle while the slot is free.
+// Padded to a cache line, so readers do not share lines.
+struct SnapshotReaderSlot {
+    static constexpr std::uint64_t idle = ~std::uint64_t(0);
+    
+    std::atomic<std::uint64_t> epoch { idle };
+    char padding[64 - sizeof(std::atomic<std::uint64_t>)];
+};
+
+// QuadTree for one writer thread and many reader threads, where readers
+// never wait for the writer. The nodes are never changed once published:
+// a mutation copies the path from the root to the nodes it changes, the
+// rest of the tree is shared with the previous version, and publishes the
+// new root by one atomic store. A batch makes one version, so every node
+// is copied at most once per batch.
+//
+// A reader pins the current epoch in a slot of its own and queries the
+// version it found, without locks, however long it takes and whatever the
+// writer does meanwhile. The nodes a version replaced are freed by the
+// writer once every pinned epoch is newer than the version.
+//
+// Same cells and limits as QuadTree, but the tree box does not grow.
+// Values straddling the axes of the root are copied on every mutation,
+// a loose Limits keeps them few.
+template <class T, class Real = float, class Limits = QuadTreeLimits<>>
+class SnapshotQuadTree {
+  public:
+    using Box = ::Box<Real>;
+    using Value = ValueInBox<T, Real>;
+    using ValPtr = std::shared_ptr<Value>;
+    using NodeType = SnapshotNode<T, Real>;
+    
+    // Version of the tree pinned by a reader until the snapshot is destroyed
+    class Snapshot {
+      public:
+        Snapshot(Snapshot&& other) noexcept
+        : m_slot(other.m_slot)
+        , m_root(other.m_root)
+        , m_tree_box(other.m_tree_box)
+        {
+            other.m_slot = nullptr;
+        }
+        
+        Snapshot(Snapshot const&) = delete;
+        Snapshot& operator=(Snapshot const&) = delete;
+        
+        ~Snapshot() {
+            if (m_slot) m_slot->epoch.store(SnapshotReaderSlot::idle);
+        }
+        
+        // Count of values in the version
+        std::size_t size() const {
+            return m_root->count;
+        }
+        
+        // Grows with every published mutation or batch
+        std::uint64_t version() const {
+            return m_root->version;
+        }
+        
+        std::vector<ValPtr> query(Box const& query_box) const {
+            std::vector<ValPtr> match_values;
+            if (!query_box.intersects(Cells::bounds(m_tree_box))) return match_values;
+            auto collect = [&match_values] (ValPtr const& value) {
+                match_values.push_back(value);
+                return true;
+            };
+            visit(m_root, m_tree_box, query_box, collect);
+            return match_values;
+        }
+        
+        // Calls callback(Value const&) for the values intersecting query_box
+        // until it returns false, like QuadTree::queryVisit(): no reference
+        // counter is touched. Returns false if the callback stopped the query.
+        template <class Callback>
+        bool queryVisit(Box const& query_box, Callback callback) const {
+            if (!query_box.intersects(Cells::bounds(m_tree_box))) return true;
+            auto visitor = [&callback] (ValPtr const& value) {
+                return callback(static_cast<Value const&>(*value));
+            };
+            return visit(m_root, m_tree_box, query_box, visitor);
+        }
+      
+      private:
+        friend class SnapshotQuadTree;
+        
+        Snapshot(SnapshotReaderSlot* slot, NodeType const* root, Box const& tree_box)
+        : m_slot(slot)
+        , m_root(root)
+        , m_tree_box(tree_box)
+        { }
+      
+      private:
+        SnapshotReaderSlot* m_slot;
+        NodeType const* m_root;
+        Box m_tree_box;
+    };
+    
+  public:
+    // At most max_readers snapshots are pinned at once,
+    // a reader past them waits for a free slot
+    explicit SnapshotQuadTree(Box tree_box, std::size_t max_readers = 64)
+    : m_tree_box(tree_box)
+    , m_slots(new SnapshotReaderSlot[max_readers])
+    , m_slot_count(max_readers)
+    , m_head(new NodeType())
+    {
+        assert(max_readers > 0);
+        m_root.store(m_head);
+    }
+    
+    SnapshotQuadTree(SnapshotQuadTree const&) = delete;
+    SnapshotQuadTree& operator=(SnapshotQuadTree const&) = delete;
+    
+    ~SnapshotQuadTree() {
+        for (std::size_t i = 0; i != m_slot_count; ++i) {
+            assert(m_slots[i].epoch.load() == SnapshotReaderSlot::idle &&
+                   "A snapshot outlives its tree");
+        }
+        destroy(m_head);
+        for (Retired& retired: m_retired) {
+            for (NodeType* node: retired.nodes) delete node;
+        }
+    }
+    
+    // Pins the latest published version. Safe to call from any thread.
+    Snapshot snapshot() const {
+        std::size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+        for (std::size_t attempt = 0; ; ++attempt) {
+            SnapshotReaderSlot& slot = m_slots[(start + attempt) % m_slot_count];
+            std::uint64_t expected = SnapshotReaderSlot::idle;
+            // The root is read after the epoch is pinned: a writer that missed
+            // the pin published that root before, so it frees no node of it
+            if (slot.epoch.load() == SnapshotReaderSlot::idle &&
+                slot.epoch.compare_exchange_strong(expected, m_epoch.load())) {
+                return Snapshot(&slot, m_root.load(), m_tree_box);
+            }
+            if ((attempt + 1) % m_slot_count == 0) std::this_thread::yield();
+        }
+    }
+    
+    // Writer side, one thread at a time
+    
+    void add(ValPtr const& value) {
+        insert(value);
+        publish();
+    }
+    
+    void remove(ValPtr const& value) {
+        erase(value);
+        publish();
+    }
+    
+    // Removes the values equal to removes, then adds copies of adds,
+    // and publishes them as one version
+    void apply(std::vector<ValPtr> const& adds, std::vector<ValPtr> const& removes) {
+        for (ValPtr const& value: removes) erase(value);
+        for (ValPtr const& value: adds) insert(value);
+        publish();
+    }
+    
+    // Count of values in the latest version
+    std::size_t size() const {
+        return m_head->count;
+    }
+    
+    // Nodes replaced by newer versions and still pinned by readers
+    std::size_t retiredNodes() const {
+        std::size_t nodes = 0;
+        for (Retired const& retired: m_retired) nodes += retired.nodes.size();
+        return nodes;
+    }
+    
+    // Frees the replaced nodes no reader can reach any more.
+    // Publishing does it too, an idle writer calls it to free memory sooner.
+    void reclaim() {
+        std::uint64_t oldest = SnapshotReaderSlot::idle;
+        for (std::size_t i = 0; i != m_slot_count; ++i) {
+            std::uint64_t epoch = m_slots[i].epoch.load();
+            if (epoch < oldest) oldest = epoch;
+        }
+        while (!m_retired.empty() && m_retired.front().epoch < oldest) {
+            for (NodeType* node: m_retired.front().nodes) delete node;
+            m_retired.pop_front();
+        }
+    }
+    
+  private:
+    using Cells = Node<T, Real, Limits>;
+    using Quadrants = typename Box::Quadrants;
+    
+    // Nodes replaced by the version published at the epoch
+    struct Retired {
+        std::uint64_t epoch;
+        std::vector<NodeType*> nodes;
+    };
+    
+    template <class Callback>
+    static bool visit(NodeType const* node, Box const& cell, Box const& query_box, Callback& callback) {
+        auto match = [node, &callback] (std::size_t i) {
+            return callback(node->values[i]);
+        };
+        if (!node->boxes.forEachIntersecting(query_box, match)) {
+            return false;
+        }
+        
+        if (!node->isLeaf()) {
+            for (int i = 0; i != 4; ++i) {
+                Box child_box = cell.quadrantByIndex(i);
+                if (query_box.intersects(Cells::bounds(child_box)) &&
+                    !visit(node->children[static_cast<std::size_t>(i)], child_box, query_box, callback)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    
+    void insert(ValPtr const& value) {
+        ValPtr clone = value->clone();
+        Box box = clone->getBox();
+        m_head = addTo(m_head, 0, m_tree_box, std::move(clone), box);
+    }
+    
+    void erase(ValPtr const& value) {
+        m_head = removeFrom(m_head, m_tree_box, value, value->getBox());
+    }
+    
+    // Makes the new version visible to the next snapshots
+    void publish() {
+        m_root.store(m_head);
+        std::uint64_t epoch = m_epoch.fetch_add(1);
+        if (!m_garbage.empty()) {
+            m_retired.push_back(Retired { epoch, std::move(m_garbage) });
+            m_garbage.clear();
+        }
+        ++m_version;
+        reclaim();
+    }
+    
+    // The node itself if the current version made it, otherwise its copy
+    NodeType* writable(NodeType* node) {
+        if (node->version == m_version) return node;
+        NodeType* copy = new NodeType();
+        copy->children = node->children;
+        copy->values = node->values;
+        copy->boxes.reserve(node->boxes.size());
+        for (std::size_t i = 0; i != node->boxes.size(); ++i) {
+            copy->boxes.push_back(node->boxes[i]);
+        }
+        copy->count = node->count;
+        copy->version = m_version;
+        retire(node);
+        return copy;
+    }
+    
+    // Frees a node of the current version at once, readers never saw it
+    void retire(NodeType* node) {
+        if (node->version == m_version) {
+            delete node;
+        } else {
+            m_garbage.push_back(node);
+        }
+    }
+    
+    NodeType* addTo(NodeType* node, std::size_t depth, Box const& cell, ValPtr&& value, Box const& box) {
+        assert(Cells::bounds(cell).contains(box));
+        node = writable(node);
+        ++node->count;
+        if (node->isLeaf() && depth < Limits::max_depth && node->values.size() >= Limits::max_values) {
+            split(node, cell);
+        }
+        
+        Quadrants i = node->isLeaf() ? Quadrants::NEITHER_ONE_QUADRANT : Cells::childFor(cell, box);
+        if (i == Quadrants::NEITHER_ONE_QUADRANT) {
+            node->values.push_back(std::move(value));
+            node->boxes.push_back(box);
+        } else {
+            NodeType*& child = node->children[static_cast<std::size_t>(i)];
+            child = addTo(child, depth + 1, cell.quadrantByIndex(i), std::move(value), box);
+        }
+        return node;
+    }
+    
+    // The node is writable
+    void split(NodeType* node, Box const& cell) {
+        for (NodeType*& child: node->children) {
+            child = new NodeType();
+            child->version = m_version;
+        }
+        
+        std::vector<ValPtr> values = std::move(node->values);
+        BoxArray<Real> boxes = std::move(node->boxes);
+        node->values.clear();
+        for (std::size_t k = 0; k != values.size(); ++k) {
+            Box box = boxes[k];
+            Quadrants i = Cells::childFor(cell, box);
+            NodeType* target = node;
+            if (i != Quadrants::NEITHER_ONE_QUADRANT) {
+                target = node->children[static_cast<std::size_t>(i)];
+                ++target->count;
+            }
+            target->values.push_back(std::move(values[k]));
+            target->boxes.push_back(box);
+        }
+    }
+    
+    NodeType* removeFrom(NodeType* node, Box const& cell, ValPtr const& value, Box const& box) {
+        Quadrants i = node->isLeaf() ? Quadrants::NEITHER_ONE_QUADRANT : Cells::childFor(cell, box);
+        if (i != Quadrants::NEITHER_ONE_QUADRANT) {
+            std::size_t c = static_cast<std::size_t>(i);
+            NodeType* child = removeFrom(node->children[c], cell.quadrantByIndex(i), value, box);
+            node = writable(node);
+            node->children[c] = child;
+        } else {
+            auto found = std::find_if(
+                node->values.begin(), node->values.end(),
+                [&value] (ValPtr const& rhs) {
+                    return *value == *rhs;
+                }
+            );
+            assert(found != node->values.end() && "Trying to remove a value that is not present in the tree");
+            std::size_t slot = static_cast<std::size_t>(found - node->values.begin());
+            node = writable(node);
+            node->values[slot] = std::move(node->values.back());
+            node->values.pop_back();
+            node->boxes.swapRemove(slot);
+        }
+        --node->count;
+        tryMerge(node);
+        return node;
+    }
+    
+    // Takes the values of the leaf children into the node if they fit it.
+    // The node is writable.
+    void tryMerge(NodeType* node) {
+        if (node->isLeaf() || node->count > Limits::merge_values) return;
+        for (NodeType* child: node->children) {
+            if (!child->isLeaf()) return;
+        }
+        
+        node->values.reserve(node->count);
+        node->boxes.reserve(node->count);
+        for (NodeType*& child: node->children) {
+            for (std::size_t k = 0; k != child->values.size(); ++k) {
+                node->values.push_back(child->values[k]);
+                node->boxes.push_back(child->boxes[k]);
+            }
+            retire(child);
+            child = nullptr;
+        }
+    }
+    
+    static void destroy(NodeType* node) {
+        if (!node->isLeaf()) {
+            for (NodeType* child: node->children) destroy(child);
+        }
+        delete node;
+    }
+    
+  private:
+    Box m_tree_box;
+    std::unique_ptr<SnapshotReaderSlot[]> m_slots;
+    std::size_t m_slot_count;
+    std::atomic<NodeType const*> m_root { nullptr };
+    std::atomic<std::uint64_t> m_epoch { 0 };
+    
+    // Writer state
+    NodeType* m_head;
+    // Version being made, the empty root is the version 0
+    std::uint64_t m_version = 1;
+    // Nodes replaced by the version being made
+    std::vector<NodeType*> m_garbage;
+    std::deque<Retired> m_retired;
+};
+
+#endif // QUADTREE_SNAPSHOTQUADTREE_HPP
@@ -8,13 +8,35 @@
 
 #include <iostream>
 #include <functional>
+#include <random>
+#include <tuple>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <atomic>
+#include <chrono>
 #include "Box.hpp"
 
+// The per-query counters are tested, see QuadTreeStats.hpp.
+// The QUADTREE_QUERY_COUNTERS option of the build defines it already
+#ifndef QUADTREE_QUERY_COUNTERS
+#define QUADTREE_QUERY_COUNTERS
+#endif
 #define protected public
 #include "QuadTreeBase.hpp"
 #define private public
 #include "QuadTree.hpp"
 #include "QuadTreeParallel.hpp"
+#include "ValueQuadTree.hpp"
+#include "BoxArray.hpp"
+#include "QuadTreeTuner.hpp"
+#include "PointQuadTree.hpp"
+#include "MappedQuadTree.hpp"
+#include "PagedQuadTree.hpp"
+#include "SnapshotQuadTree.hpp"
 #undef private
 #undef protected
 
@@ -347,30 +369,30 @@ void QuadTree_AddValuesTest() {
         }
     }
     
-    assert(quadtree.m_root_node->isLeaf());
-    assert(quadtree.m_root_node->m_values.size() == decltype(quadtree)::NodeType::getMaxValuesSize());
+    assert(quadtree.root().isLeaf());
+    assert(quadtree.root().m_values.size() == decltype(quadtree)::NodeType::getMaxValuesSize());
     
     for(auto const& value: values) {
         // Add one object to all child nodes
         quadtree.add(value);
     }
     
-    assert(!quadtree.m_root_node->isLeaf());
-    assert(quadtree.m_root_node->m_values.empty());
-    for(auto const& child: quadtree.m_root_node->m_children) {
-        assert(child->m_values.size() == 5);
+    assert(!quadtree.root().isLeaf());
+    assert(quadtree.root().m_values.empty());
+    for(int i = 0; i != 4; ++i) {
+        assert(quadtree.root().child(quadtree.m_storage->pool, i).m_values.size() == 5);
     }
     
     // Add unbounded value
     quadtree.add(std::make_shared<TreeObj>(Box<float>(10, 10, 60, 10)));
     quadtree.add(std::make_shared<TreeObj>(Box<float>(10, 10, 10, 60)));
     quadtree.add(std::make_shared<TreeObj>(Box<float>(10, 10, 60, 60)));
-    assert(quadtree.m_root_node->m_values.size() == 3);
+    assert(quadtree.root().m_values.size() == 3);
     
     for(int i = 0; i != 16; ++i) {
         quadtree.add(std::make_shared<TreeObj>(Box<float>(10, 10, 60, 60)));
     }
-    assert(quadtree.m_root_node->m_values.size() == 19);
+    assert(quadtree.root().m_values.size() == 19);
     
     std::cout << "QuadTree add values work normal...\n";
 }
@@ -409,7 +431,7 @@ void QuadTree_RemoveValuesTest() {
         }
     }
     
-    assert(quadtree.m_root_node->m_values.empty());
+    assert(quadtree.root().m_values.empty());
     
     std::cout << "QuadTree values removed correctly...\n";
 }
@@ -442,12 +464,12 @@ void QuadTree_MergeTest() {
         }
     }
     
-    assert(!quadtree.m_root_node->isLeaf());
+    assert(!quadtree.root().isLeaf());
     for(auto const& value: values) {
         quadtree.remove(value);
     }
     
-    assert(quadtree.m_root_node->isLeaf());
+    assert(quadtree.root().isLeaf());
     
     std::cout << "QuadTree merge test pass...\n";
 }
@@ -486,7 +508,1395 @@ void QuadTree_IntersectTest() {
     std::cout << "QuadTree intersect work correctly...\n";
 }
 
+using TestViB = ValueInBox<Box<float>>;
+class TestObj: public TestViB, public ClonableDerived<TestObj, TestViB> {
+  public:
+    explicit TestObj(Box box): value(box) { }
+    Box getBox() const override { return value; }
+    Box& getValue() override { return value; }
+  
+  private:
+    Box value;
+};
+
+// Mostly small boxes with some large ones, which straddle the quadrants
+std::vector<std::shared_ptr<TestObj>> randomValues(std::size_t count, float world_size,
+                                                   unsigned seed = 42) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> position(0, 1);
+    std::vector<std::shared_ptr<TestObj>> values;
+    for(std::size_t i = 0; i != count; ++i) {
+        float size = world_size * (i % 10 == 0 ? 0.2f : 0.005f) * position(random);
+        float x = (world_size - size) * position(random);
+        float y = (world_size - size) * position(random);
+        values.push_back(std::make_shared<TestObj>(Box<float>(x, y, size, size)));
+    }
+    return values;
+}
+
+bool lessBox(Box<float> const& lhs, Box<float> const& rhs) {
+    return std::tie(lhs.left, lhs.top, lhs.width, lhs.height) <
+           std::tie(rhs.left, rhs.top, rhs.width, rhs.height);
+}
+
+template <class ValPtr>
+std::vector<Box<float>> sortedBoxes(std::vector<ValPtr> const& values) {
+    std::vector<Box<float>> boxes;
+    for(auto const& value: values) boxes.push_back(value->getBox());
+    std::sort(boxes.begin(), boxes.end(), lessBox);
+    return boxes;
+}
+
+template <class PoolT, class NodeT>
+bool sameShape(PoolT const& lhs_pool, NodeT const& lhs, PoolT const& rhs_pool, NodeT const& rhs) {
+    if(lhs.isLeaf() != rhs.isLeaf()) return false;
+    if(!(sortedBoxes(lhs.m_values) == sortedBoxes(rhs.m_values))) return false;
+    if(lhs.isLeaf()) return true;
+    for(int i = 0; i != 4; ++i) {
+        if(!sameShape(lhs_pool, lhs.child(lhs_pool, i), rhs_pool, rhs.child(rhs_pool, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class Tree>
+bool sameShape(Tree const& lhs, Tree const& rhs) {
+    return sameShape(lhs.m_storage->pool, lhs.root(), rhs.m_storage->pool, rhs.root());
+}
+
+void QuadTree_BulkLoadTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(20000, 1000);
+    
+    QT added(world);
+    for(auto const& value: values) {
+        added.add(value);
+    }
+    
+    QT loaded(world, values.begin(), values.end());
+    assert(sameShape(added, loaded));
+    
+    QT loaded_parallel(world);
+    loaded_parallel.bulkLoad(values.begin(), values.end(), 8);
+    assert(sameShape(added, loaded_parallel));
+    assert(!loaded.root().isLeaf());
+    
+    auto query_box = Box<float>(100, 100, 300, 200);
+    assert(sortedBoxes(added.query(query_box)) == sortedBoxes(loaded.query(query_box)));
+    
+    // Values are cloned like in add(), and the tree stays usable
+    assert(loaded.query(values[0]->getBox())[0] != values[0]);
+    for(auto const& value: values) {
+        loaded.remove(value);
+    }
+    assert(loaded.query(world).empty());
+    
+    QT small(world);
+    small.bulkLoad(values.begin(), values.begin() + 3);
+    assert(small.root().isLeaf() && small.root().m_values.size() == 3);
+    
+    std::cout << "QuadTree bulk load builds the same tree as add...\n";
+}
+
+void QuadTree_QueryBatchTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(5000, 1000);
+    QT quadtree(world, values.begin(), values.end());
+    
+    std::vector<Box<float>> query_boxes;
+    for(auto const& value: randomValues(300, 1000, 7)) {
+        Box<float> box = value->getBox();
+        query_boxes.push_back(Box<float>(box.left, box.top, box.width + 30, box.height + 30));
+    }
+    query_boxes.push_back(Box<float>(-100, -100, 10, 10));
+    
+    auto batch = quadtree.queryBatch(query_boxes, 4);
+    assert(batch.size() == query_boxes.size());
+    assert(batch.offsets.back() == batch.values.size());
+    for(std::size_t i = 0; i != query_boxes.size(); ++i) {
+        std::vector<QT::ValPtr> matches(batch.begin(i), batch.end(i));
+        std::vector<QT::ValPtr> expected;
+        if(query_boxes[i].intersects(world)) expected = quadtree.query(query_boxes[i]);
+        assert(matches == expected);
+    }
+    assert(batch.count(query_boxes.size() - 1) == 0);
+    
+    std::cout << "QuadTree batch query works...\n";
+}
+
+void QuadTree_QueryVisitTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(5000, 1000);
+    QT quadtree(world, values.begin(), values.end());
+    
+    Box<float> query_box(200, 300, 150, 100);
+    std::vector<Box<float>> visited;
+    bool completed = quadtree.queryVisit(query_box, [&visited] (QT::Value const& value) {
+        visited.push_back(value.getValue());
+        return true;
+    });
+    assert(completed);
+    std::sort(visited.begin(), visited.end(), lessBox);
+    assert(sortedBoxes(quadtree.query(query_box)) == visited);
+    
+    std::size_t calls = 0;
+    completed = quadtree.queryVisit(query_box, [&calls] (QT::Value const&) {
+        return ++calls != 3;
+    });
+    assert(!completed && calls == 3);
+    
+    assert(quadtree.queryAny(query_box));
+    assert(!quadtree.queryAny(Box<float>(2000, 2000, 10, 10)));
+    QT empty(world);
+    assert(!empty.queryAny(world));
+    
+    std::cout << "QuadTree visitor query works and stops on demand...\n";
+}
+
+void ValueQuadTree_Test() {
+    struct Unit {
+        int id;
+        Box<float> box;
+        
+        bool operator==(Unit const& other) const { return id == other.id; }
+    };
+    struct UnitBox {
+        Box<float> operator()(Unit const& unit) const { return unit.box; }
+    };
+    
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(3000, 1000);
+    QuadTree<Box<float>> reference(world, values.begin(), values.end());
+    ValueQuadTree<Unit, float, UnitBox> quadtree(world);
+    for(std::size_t i = 0; i != values.size(); ++i) {
+        quadtree.add(Unit { static_cast<int>(i), values[i]->getBox() });
+    }
+    
+    Box<float> query_box(100, 500, 300, 80);
+    std::vector<Box<float>> found;
+    for(Unit const& unit: quadtree.query(query_box)) {
+        assert(unit.box.intersects(query_box));
+        found.push_back(unit.box);
+    }
+    std::sort(found.begin(), found.end(), lessBox);
+    assert(found == sortedBoxes(reference.query(query_box)));
+    
+    for(std::size_t i = 0; i != values.size(); ++i) {
+        quadtree.remove(Unit { static_cast<int>(i), values[i]->getBox() });
+    }
+    assert(quadtree.query(world).empty() && quadtree.size() == 0);
+    assert((*quadtree.m_pool)[0].isLeaf() && quadtree.m_pool->size() == 4);
+    
+    // Limits reach the nodes like in QuadTree, loose cells included
+    using Loose = QuadTreeLimits<4, 6, std::ratio<2>>;
+    ValueQuadTree<Unit, float, UnitBox, Loose> loose(world);
+    QuadTree<Box<float>, float, Loose> loose_reference(world, values.begin(), values.end());
+    for(std::size_t i = 0; i != values.size(); ++i) {
+        loose.add(Unit { static_cast<int>(i), values[i]->getBox() });
+    }
+    assert(loose.size() == values.size());
+    for(auto const& query: randomValues(50, 1000, 7)) {
+        std::vector<Box<float>> loose_found;
+        for(Unit const& unit: loose.query(query->getBox())) loose_found.push_back(unit.box);
+        std::sort(loose_found.begin(), loose_found.end(), lessBox);
+        assert(loose_found == sortedBoxes(loose_reference.query(query->getBox())));
+    }
+    assert(loose.m_pool->size() == loose_reference.m_storage->pool.size());
+    for(std::size_t i = 0; i != values.size(); ++i) {
+        loose.remove(Unit { static_cast<int>(i), values[i]->getBox() });
+    }
+    assert(loose.size() == 0 && (*loose.m_pool)[0].isLeaf());
+    
+    std::cout << "ValueQuadTree stores values inline and queries them...\n";
+}
+
+template <class Real>
+void BoxArray_IntersectTest() {
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> position(-50, 150);
+    std::uniform_real_distribution<float> size(0, 40);
+    auto random_box = [&] {
+        return Box<Real>(position(random), position(random), size(random), size(random));
+    };
+    
+    // 37 boxes: whole vector blocks and a scalar tail
+    BoxArray<Real> boxes;
+    std::vector<Box<Real>> plain;
+    for(int i = 0; i != 37; ++i) {
+        plain.push_back(random_box());
+        boxes.push_back(plain.back());
+        assert(boxes[boxes.size() - 1] == plain.back());
+    }
+    boxes.swapRemove(5);
+    plain[5] = plain.back();
+    plain.pop_back();
+    
+    for(int q = 0; q != 200; ++q) {
+        Box<Real> query_box = random_box();
+        std::vector<std::size_t> found;
+        auto collect = [&found] (std::size_t i) { found.push_back(i); return true; };
+        assert(boxes.forEachIntersecting(query_box, collect));
+        
+        std::vector<std::size_t> expected;
+        for(std::size_t i = 0; i != plain.size(); ++i) {
+            if(query_box.intersects(plain[i])) expected.push_back(i);
+        }
+        assert(found == expected);
+        
+        if(expected.size() >= 2) {
+            std::size_t calls = 0;
+            auto first_two = [&calls] (std::size_t) { return ++calls != 2; };
+            assert(!boxes.forEachIntersecting(query_box, first_two) && calls == 2);
+        }
+    }
+}
+
+void QuadTree_NodePoolTest() {
+    using QT = QuadTree<Box<float>>;
+    QT quadtree(Box<float>(0, 0, 100, 100));
+    auto values = randomValues(40, 100);
+    
+    // Split and merge again and again: the freed children block is reused
+    for(int round = 0; round != 50; ++round) {
+        for(auto const& value: values) quadtree.add(value);
+        assert(!quadtree.root().isLeaf());
+        for(auto const& value: values) quadtree.remove(value);
+        assert(quadtree.root().isLeaf());
+    }
+    std::size_t capacity = quadtree.m_storage->pool.capacity();
+    assert(quadtree.m_storage->pool.size() == 4);
+    
+    // Blocks of many splits, the nodes stay addressable while the pool grows
+    auto many = randomValues(30000, 100, 5);
+    for(auto const& value: many) quadtree.add(value);
+    assert(quadtree.m_storage->pool.capacity() > capacity);
+    assert(quadtree.query(Box<float>(0, 0, 100, 100)).size() == many.size());
+    
+    std::cout << "QuadTree nodes live in the pool and are reused...\n";
+}
+
+void LinearQuadTree_FreezeTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(10000, 1000);
+    QT quadtree(world, values.begin(), values.end());
+    assert(quadtree.size() == values.size());
+    
+    LinearQuadTree<Box<float>> frozen = quadtree.freeze();
+    assert(frozen.values().size() == values.size());
+    assert(frozen.boxes().size() == values.size());
+    for(auto const& value: randomValues(200, 1000, 11)) {
+        Box<float> box = value->getBox();
+        Box<float> query_box(box.left, box.top, box.width + 50, box.height + 20);
+        assert(sortedBoxes(frozen.query(query_box)) == sortedBoxes(quadtree.query(query_box)));
+    }
+    
+    std::size_t calls = 0;
+    assert(!frozen.queryVisit(world, [&calls] (QT::Value const&) { return ++calls != 10; }));
+    assert(calls == 10);
+    
+    // The snapshot does not follow the tree
+    for(std::size_t i = 0; i != 100; ++i) quadtree.remove(values[i]);
+    assert(quadtree.size() == values.size() - 100);
+    assert(frozen.query(world).size() == values.size());
+    
+    QT empty(world);
+    assert(empty.freeze().query(world).empty());
+    
+    std::cout << "QuadTree freezes to a linear tree with the same queries...\n";
+}
+
+void MappedQuadTree_SaveTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(10000, 1000);
+    QT quadtree(world, values.begin(), values.end());
+    std::string const path = "quadtree_test.map";
+    
+    // The payload is the value itself, a box
+    assert(quadtree.save(path));
+    {
+        MappedQuadTree<Box<float>> mapped(path);
+        assert(mapped.isOpen());
+        assert(mapped.size() == values.size());
+        assert(mapped.treeBox() == world);
+        for(auto const& value: randomValues(200, 1000, 11)) {
+            Box<float> box = value->getBox();
+            Box<float> query_box(box.left, box.top, box.width + 50, box.height + 20);
+            std::vector<Box<float>> boxes = mapped.query(query_box);
+            std::sort(boxes.begin(), boxes.end(), lessBox);
+            assert(boxes == sortedBoxes(quadtree.query(query_box)));
+        }
+        std::size_t calls = 0;
+        assert(!mapped.queryVisit(world, [&calls] (Box<float> const&) { return ++calls != 10; }));
+        assert(calls == 10);
+        
+        // Other payload or coordinate types do not open the file
+        assert(!MappedQuadTree<std::uint32_t>(path).isOpen());
+        assert(!(MappedQuadTree<Box<float>, double>(path).isOpen()));
+        assert(!(MappedQuadTree<Box<float>, float, std::ratio<3, 2>>(path).isOpen()));
+    }
+    
+    // An index payload, stored by a loose tree
+    using Loose = QuadTree<Box<float>, float, QuadTreeLimits<16, 8, std::ratio<3, 2>>>;
+    Loose loose(world, values.begin(), values.end());
+    std::vector<Box<float>> table;
+    assert(loose.save(path, [&table] (Loose::Value const& value) {
+        table.push_back(value.getBox());
+        return static_cast<std::uint32_t>(table.size() - 1);
+    }));
+    {
+        MappedQuadTree<std::uint32_t, float, std::ratio<3, 2>> mapped(path);
+        assert(mapped.isOpen());
+        for(auto const& value: randomValues(100, 1000, 12)) {
+            std::vector<Box<float>> boxes;
+            mapped.queryIndices(value->getBox(), [&] (std::size_t i) {
+                assert(mapped.box(i) == table[mapped.payload(i)]);
+                boxes.push_back(table[mapped.payload(i)]);
+                return true;
+            });
+            std::sort(boxes.begin(), boxes.end(), lessBox);
+            assert(boxes == sortedBoxes(loose.query(value->getBox())));
+        }
+    }
+    
+    // A truncated file or no file at all leaves the tree closed
+    std::string content;
+    {
+        std::ifstream file(path, std::ios::binary);
+        content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(content.data(), static_cast<std::streamsize>(content.size() / 2));
+    }
+    assert(!(MappedQuadTree<std::uint32_t, float, std::ratio<3, 2>>(path).isOpen()));
+    
+    // So does a node linking out of the nodes or of the values
+    QuadTreeFileHeader header;
+    std::memcpy(&header, content.data(), sizeof(header));
+    auto damaged = [&] (std::function<void(LinearQuadTreeNode&)> damage) {
+        std::string bytes = content;
+        LinearQuadTreeNode node;
+        char* root = &bytes[static_cast<std::size_t>(header.nodes_offset)];
+        std::memcpy(&node, root, sizeof(node));
+        damage(node);
+        std::memcpy(root, &node, sizeof(node));
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        file.close();
+        return !MappedQuadTree<std::uint32_t, float, std::ratio<3, 2>>(path).isOpen();
+    };
+    assert(!damaged([] (LinearQuadTreeNode&) { }));
+    assert(damaged([&] (LinearQuadTreeNode& node) {
+        node.first_child = static_cast<std::uint32_t>(header.node_count) - 3;
+    }));
+    assert(damaged([] (LinearQuadTreeNode& node) { node.first_child = 0; }));
+    assert(damaged([&] (LinearQuadTreeNode& node) {
+        node.values_end = static_cast<std::uint32_t>(header.value_count) + 1;
+    }));
+    assert(damaged([] (LinearQuadTreeNode& node) {
+        node.values_begin = node.values_end + 1;
+    }));
+    assert(std::remove(path.c_str()) == 0);
+    assert(!MappedQuadTree<Box<float>>(path).isOpen());
+    assert(MappedQuadTree<Box<float>>(path).query(world).empty());
+    
+    QT empty(world);
+    assert(empty.save(path));
+    assert(MappedQuadTree<Box<float>>(path).isOpen());
+    assert(MappedQuadTree<Box<float>>(path).query(world).empty());
+    assert(std::remove(path.c_str()) == 0);
+    
+    std::cout << "QuadTree saves to a file queried in place after mapping...\n";
+}
+
+template <class Tree, class Values>
+void checkHandleLocations(Tree const& tree, std::vector<QuadTreeHandle> const& handles,
+                          Values const& values) {
+    for(std::size_t i = 0; i != handles.size(); ++i) {
+        assert(tree.contains(handles[i]));
+        assert(*tree.get(handles[i]) == *values[i]);
+    }
+}
+
+void QuadTree_HandleRemoveTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(3000, 1000);
+    
+    QT quadtree(world);
+    std::vector<QuadTreeHandle> handles;
+    for(auto const& value: values) handles.push_back(quadtree.insert(value));
+    checkHandleLocations(quadtree, handles, values);
+    
+    // Every split and merge moves values between nodes
+    for(std::size_t i = 0; i < values.size(); i += 2) quadtree.remove(handles[i]);
+    std::vector<QuadTreeHandle> kept_handles;
+    decltype(values) kept_values;
+    for(std::size_t i = 1; i < values.size(); i += 2) {
+        kept_handles.push_back(handles[i]);
+        kept_values.push_back(values[i]);
+    }
+    checkHandleLocations(quadtree, kept_handles, kept_values);
+    assert(quadtree.size() == kept_values.size());
+    assert(sortedBoxes(quadtree.query(world)) == sortedBoxes(kept_values));
+    
+    // Removal by handle merges like removal by value
+    QT by_value(world);
+    for(auto const& value: values) by_value.add(value);
+    for(std::size_t i = 0; i < values.size(); i += 2) by_value.remove(values[i]);
+    assert(sameShape(quadtree, by_value));
+    
+    for(auto handle: kept_handles) quadtree.remove(handle);
+    assert(quadtree.size() == 0 && quadtree.root().isLeaf());
+    assert(quadtree.m_storage->pool.size() == 4);
+    
+    // Bulk load names the values by their positions
+    QT loaded(world, values.begin(), values.end());
+    handles.clear();
+    for(std::size_t i = 0; i != values.size(); ++i) {
+        handles.push_back(QuadTreeHandle { static_cast<std::uint32_t>(i) });
+    }
+    checkHandleLocations(loaded, handles, values);
+    loaded.remove(handles[7]);
+    assert(!loaded.contains(handles[7]));
+    assert(loaded.insert(values[7]) == handles[7]);
+    
+    std::cout << "QuadTree removes values by handles...\n";
+}
+
+void QuadTree_UpdateTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(2000, 1000);
+    QT quadtree(world);
+    std::vector<QuadTreeHandle> handles;
+    for(auto const& value: values) handles.push_back(quadtree.insert(value));
+    
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> step(-5, 5);
+    auto move = [&] (Box<float> box, float scale) {
+        box.left = std::min(std::max(0.f, box.left + scale * step(random)), world.width - box.width);
+        box.top = std::min(std::max(0.f, box.top + scale * step(random)), world.height - box.height);
+        return box;
+    };
+    
+    // Small steps mostly keep the values in their nodes, large ones move them
+    // across the tree: both must give the same queries as a plain scan
+    for(float scale: { 0.1f, 1.f, 50.f }) {
+        std::size_t nodes = quadtree.m_storage->pool.size();
+        for(int frame = 0; frame != 5; ++frame) {
+            for(std::size_t i = 0; i != values.size(); ++i) {
+                Box<float> new_box = move(values[i]->getBox(), scale);
+                values[i]->getValue() = new_box;
+                quadtree.get(handles[i])->getValue() = new_box;
+                quadtree.update(handles[i], new_box);
+            }
+        }
+        if(scale < 1) assert(quadtree.m_storage->pool.size() == nodes);
+        
+        checkHandleLocations(quadtree, handles, values);
+        assert(quadtree.size() == values.size());
+        for(auto const& query: randomValues(50, 1000, 17)) {
+            Box<float> query_box = query->getBox();
+            std::vector<Box<float>> expected;
+            for(auto const& value: values) {
+                if(query_box.intersects(value->getBox())) expected.push_back(value->getBox());
+            }
+            std::sort(expected.begin(), expected.end(), lessBox);
+            assert(sortedBoxes(quadtree.query(query_box)) == expected);
+        }
+    }
+    
+    // By value: the value is found by the box it is indexed with
+    Box<float> new_box(900, 900, 10, 10);
+    quadtree.update(values[0], new_box);
+    auto location = quadtree.m_storage->locations[handles[0].id];
+    assert(quadtree.m_storage->pool[location.node].boxes()[location.slot] == new_box);
+
+    for(auto handle: handles) quadtree.remove(handle);
+    assert(quadtree.root().isLeaf() && quadtree.m_storage->pool.size() == 4);
+    
+    std::cout << "QuadTree moves values in place...\n";
+}
+
+void QuadTree_LimitsTest() {
+    using Dense = QuadTree<Box<float>, float, QuadTreeLimits<64, 4>>;
+    using Deep = QuadTree<Box<float>, float, QuadTreeLimits<2, 12>>;
+    static_assert(Dense::NodeType::getMaxValuesSize() == 64, "Limits reach the node");
+    static_assert(Deep::NodeType::getMaxDepth() == 12, "Limits reach the node");
+    
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(3000, 1000);
+    QuadTreeWorkload<Box<float>> workload(world);
+    for(auto const& value: values) workload.recordAdd(value);
+    for(auto const& query: randomValues(100, 1000, 9)) workload.recordQuery(query->getBox());
+    for(std::size_t i = 0; i < values.size(); i += 3) workload.recordRemove(values[i]);
+    for(auto const& query: randomValues(100, 1000, 10)) workload.recordQuery(query->getBox());
+    
+    // Bulk load and add agree under any limits
+    Deep deep(world, values.begin(), values.end());
+    Deep deep_added(world);
+    for(auto const& value: values) deep_added.add(value);
+    assert(sameShape(deep, deep_added));
+    
+    auto results = tuneQuadTree<Box<float>, float, QuadTreeLimits<>, QuadTreeLimits<64, 4>,
+                                QuadTreeLimits<2, 12>>(workload, 1);
+    assert(results.size() == 3);
+    for(std::size_t i = 0; i != results.size(); ++i) {
+        assert(results[i].matches == results[0].matches);
+        if(i != 0) assert(results[i - 1].seconds <= results[i].seconds);
+    }
+    
+    std::cout << "QuadTree limits are template policies and can be tuned...\n";
+}
+
+void QuadTree_NearestTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(5000, 1000);
+    QT quadtree(world, values.begin(), values.end());
+    
+    std::mt19937 random(21);
+    std::uniform_real_distribution<float> coordinate(-100, 1100);
+    for(int q = 0; q != 100; ++q) {
+        Vector2<float> point(coordinate(random), coordinate(random));
+        std::size_t k = static_cast<std::size_t>(q % 20) + 1;
+        
+        std::vector<float> expected;
+        for(auto const& value: values) expected.push_back(value->getBox().distanceSquared(point));
+        std::sort(expected.begin(), expected.end());
+        expected.resize(k);
+        
+        // Ties may come in any order, the distances may not
+        std::vector<QT::ValPtr> found = quadtree.nearest(point, k);
+        assert(found.size() == k);
+        for(std::size_t i = 0; i != k; ++i) {
+            assert(!(found[i]->getBox().distanceSquared(point) < expected[i]) &&
+                   !(found[i]->getBox().distanceSquared(point) > expected[i]));
+        }
+    }
+    
+    assert(quadtree.nearest(Vector2<float>(5, 5), 0).empty());
+    assert(quadtree.nearest(Vector2<float>(5, 5), values.size() + 10).size() == values.size());
+    assert(QT(world).nearest(Vector2<float>(5, 5), 3).empty());
+    
+    std::cout << "QuadTree finds the k nearest values...\n";
+}
+
+void QuadTree_RaycastTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(5000, 1000);
+    QT quadtree(world, values.begin(), values.end());
+    
+    std::mt19937 random(8);
+    std::uniform_real_distribution<float> coordinate(-200, 1200);
+    std::uniform_real_distribution<float> angle(0, 6.2831853f);
+    for(int q = 0; q != 200; ++q) {
+        Vector2<float> origin(coordinate(random), coordinate(random));
+        float a = angle(random);
+        // Axis parallel rays too
+        Vector2<float> direction = q % 10 == 0 ? Vector2<float>(1, 0)
+                                               : Vector2<float>(std::cos(a), std::sin(a));
+        float max_t = q % 2 == 0 ? 2000.f : 150.f;
+        
+        std::vector<float> expected;
+        for(auto const& value: values) {
+            float t = 0;
+            if(value->getBox().rayEntry(origin, direction, max_t, t)) expected.push_back(t);
+        }
+        std::sort(expected.begin(), expected.end());
+        
+        std::vector<QT::RayHit> hits = quadtree.raycastAll(origin, direction, max_t);
+        assert(hits.size() == expected.size());
+        for(std::size_t i = 0; i != hits.size(); ++i) {
+            assert(!(hits[i].t < expected[i]) && !(hits[i].t > expected[i]));
+        }
+        
+        QT::RayHit nearest = quadtree.raycast(origin, direction, max_t);
+        assert(expected.empty() == !nearest.value);
+        if(nearest.value) {
+            assert(!(nearest.t < expected[0]) && !(nearest.t > expected[0]));
+        }
+    }
+    
+    // A ray starting inside a box hits it at once
+    Box<float> box = values[3]->getBox();
+    QT::RayHit inside = quadtree.raycast(box.getCenter(), Vector2<float>(0, 1), 10);
+    assert(inside.value && !(inside.t > 0));
+    
+    std::cout << "QuadTree casts rays...\n";
+}
+
+void QuadTree_OverlappingPairsTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(3000, 1000);
+    QT quadtree(world, values.begin(), values.end());
+    
+    std::size_t expected = 0;
+    for(std::size_t i = 0; i != values.size(); ++i) {
+        for(std::size_t j = i + 1; j != values.size(); ++j) {
+            if(values[i]->getBox().intersects(values[j]->getBox())) ++expected;
+        }
+    }
+    
+    for(std::size_t threads: { 1, 4 }) {
+        std::mutex mutex;
+        std::vector<std::pair<QT::Value const*, QT::Value const*>> pairs;
+        quadtree.forEachOverlappingPair([&] (QT::Value const& a, QT::Value const& b) {
+            assert(a.getBox().intersects(b.getBox()) && &a != &b);
+            std::lock_guard<std::mutex> lock(mutex);
+            pairs.emplace_back(std::min(&a, &b), std::max(&a, &b));
+        }, threads);
+        
+        // Every pair once
+        assert(pairs.size() == expected);
+        std::sort(pairs.begin(), pairs.end());
+        assert(std::unique(pairs.begin(), pairs.end()) == pairs.end());
+    }
+    
+    std::cout << "QuadTree enumerates overlapping pairs once...\n";
+}
+
+void QuadTree_SpatialJoinTest() {
+    Box<float> world_a(0, 0, 1000, 1000);
+    Box<float> world_b(-300, 200, 1500, 900);
+    auto values_a = randomValues(3000, 1000);
+    std::vector<std::shared_ptr<TestObj>> values_b;
+    for(auto const& value: randomValues(2000, 900, 7)) {
+        Box<float> box = value->getBox();
+        values_b.push_back(std::make_shared<TestObj>(
+            Box<float>(box.left - 300, box.top + 200, box.width, box.height)
+        ));
+    }
+    
+    // Different shapes on purpose
+    QuadTree<Box<float>> tree_a(world_a, values_a.begin(), values_a.end());
+    using Deep = QuadTree<Box<float>, float, QuadTreeLimits<4, 10>>;
+    Deep tree_b(world_b, values_b.begin(), values_b.end());
+    
+    std::size_t expected = 0;
+    for(auto const& a: values_a) {
+        for(auto const& b: values_b) {
+            if(a->getBox().intersects(b->getBox())) ++expected;
+        }
+    }
+    
+    using Value = ValueInBox<Box<float>>;
+    for(std::size_t threads: { 1, 4 }) {
+        std::mutex mutex;
+        std::vector<std::pair<Value const*, Value const*>> pairs;
+        spatialJoin(tree_a, tree_b, [&] (Value const& a, Value const& b) {
+            assert(a.getBox().intersects(b.getBox()));
+            std::lock_guard<std::mutex> lock(mutex);
+            pairs.emplace_back(&a, &b);
+        }, threads);
+        
+        assert(pairs.size() == expected);
+        std::sort(pairs.begin(), pairs.end());
+        assert(std::unique(pairs.begin(), pairs.end()) == pairs.end());
+    }
+    
+    QuadTree<Box<float>> far(Box<float>(5000, 5000, 10, 10));
+    std::size_t calls = 0;
+    spatialJoin(tree_a, far, [&calls] (Value const&, Value const&) { ++calls; });
+    assert(calls == 0);
+    
+    std::cout << "QuadTree joins two trees...\n";
+}
+
+void QuadTree_LooseTest() {
+    using QT = QuadTree<Box<float>>;
+    using Loose = QuadTree<Box<float>, float, QuadTreeLimits<16, 8, std::ratio<2>>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(4000, 1000);
+    QT tight(world, values.begin(), values.end());
+    Loose loose(world);
+    std::vector<QuadTreeHandle> handles;
+    for(auto const& value: values) handles.push_back(loose.insert(value));
+    
+    // Straddlers sink below the root
+    assert(loose.root().values().size() < tight.root().values().size());
+    Loose loaded(world, values.begin(), values.end());
+    assert(sameShape(loose, loaded));
+    
+    auto frozen = loose.freeze();
+    for(auto const& query: randomValues(100, 1000, 12)) {
+        Box<float> query_box = query->getBox();
+        auto expected = sortedBoxes(tight.query(query_box));
+        assert(sortedBoxes(loose.query(query_box)) == expected);
+        assert(sortedBoxes(frozen.query(query_box)) == expected);
+        
+        Vector2<float> point = query_box.getCenter();
+        auto tight_nearest = tight.nearest(point, 5);
+        auto loose_nearest = loose.nearest(point, 5);
+        for(std::size_t i = 0; i != 5; ++i) {
+            float lhs = tight_nearest[i]->getBox().distanceSquared(point);
+            float rhs = loose_nearest[i]->getBox().distanceSquared(point);
+            assert(!(lhs < rhs) && !(lhs > rhs));
+        }
+        
+        Vector2<float> direction(0.6f, 0.8f);
+        assert(loose.raycastAll(point, direction, 500).size() ==
+               tight.raycastAll(point, direction, 500).size());
+    }
+    
+    std::size_t tight_pairs = 0, loose_pairs = 0, joined = 0;
+    using Value = QT::Value;
+    tight.forEachOverlappingPair([&] (Value const&, Value const&) { ++tight_pairs; }, 1);
+    loose.forEachOverlappingPair([&] (Value const&, Value const&) { ++loose_pairs; }, 1);
+    spatialJoin(loose, tight, [&] (Value const&, Value const&) { ++joined; }, 1);
+    assert(loose_pairs == tight_pairs);
+    assert(joined == 2 * tight_pairs + values.size());
+    
+    // Moves and removals keep the loose placement valid
+    for(std::size_t i = 0; i < values.size(); i += 3) {
+        Box<float> box = values[i]->getBox();
+        Box<float> new_box(1000 - box.left - box.width, box.top, box.width, box.height);
+        values[i]->getValue() = new_box;
+        loose.get(handles[i])->getValue() = new_box;
+        loose.update(handles[i], new_box);
+    }
+    for(std::size_t i = 1; i < values.size(); i += 3) loose.remove(handles[i]);
+    for(auto const& query: randomValues(100, 1000, 13)) {
+        Box<float> query_box = query->getBox();
+        std::vector<Box<float>> expected;
+        for(std::size_t i = 0; i != values.size(); ++i) {
+            if(i % 3 != 1 && query_box.intersects(values[i]->getBox())) {
+                expected.push_back(values[i]->getBox());
+            }
+        }
+        std::sort(expected.begin(), expected.end(), lessBox);
+        assert(sortedBoxes(loose.query(query_box)) == expected);
+    }
+    
+    // Moved values lie on the route of add(), so they are found by value
+    for(std::size_t i = 0; i < values.size(); i += 3) {
+        assert(loose.root().find(loose.m_storage->pool, 0, loose.m_tree_box, values[i]) == handles[i]);
+    }
+    for(std::size_t i = 0; i != values.size(); ++i) {
+        if(i % 3 != 1) loose.remove(values[i]);
+    }
+    assert(loose.size() == 0);
+    
+    // A small move keeps the value in the loose bounds of its leaf,
+    // but off the route add() gives the new box
+    using Narrow = QuadTree<Box<float>, float, QuadTreeLimits<1, 4, std::ratio<2>>>;
+    Narrow narrow(Box<float>(0, 0, 100, 100));
+    narrow.add(std::make_shared<TestObj>(Box<float>(70, 70, 2, 2)));
+    auto moved = std::make_shared<TestObj>(Box<float>(20, 20, 2, 2));
+    QuadTreeHandle moved_handle = narrow.insert(moved);
+    moved->getValue() = Box<float>(52, 20, 2, 2);
+    narrow.get(moved_handle)->getValue() = moved->getValue();
+    narrow.update(moved_handle, moved->getValue());
+    assert(narrow.query(Box<float>(51, 19, 4, 4)).size() == 1);
+    // By value the old box finds it, then the value follows the new one
+    narrow.update(moved, Box<float>(53, 20, 2, 2));
+    moved->getValue() = Box<float>(53, 20, 2, 2);
+    narrow.get(moved_handle)->getValue() = moved->getValue();
+    narrow.remove(moved);
+    assert(narrow.size() == 1 && narrow.query(Box<float>(0, 0, 100, 100)).size() == 1);
+    
+    std::cout << "Loose QuadTree keeps straddlers out of the root...\n";
+}
+
+template <class Tree>
+void checkGrownTree(Tree& tree, std::vector<std::shared_ptr<TestObj>> const& values) {
+    std::vector<QuadTreeHandle> handles;
+    for(auto const& value: values) handles.push_back(tree.insert(value));
+    assert(tree.size() == values.size());
+    checkHandleLocations(tree, handles, values);
+    for(auto const& value: values) assert(tree.m_tree_box.contains(value->getBox()));
+    
+    for(auto const& query: randomValues(100, 2000, 14)) {
+        Box<float> query_box = query->getBox();
+        query_box.left -= 1000;
+        query_box.top -= 1000;
+        std::vector<Box<float>> expected;
+        for(auto const& value: values) {
+            if(query_box.intersects(value->getBox())) expected.push_back(value->getBox());
+        }
+        std::sort(expected.begin(), expected.end(), lessBox);
+        assert(sortedBoxes(tree.query(query_box)) == expected);
+    }
+    
+    // Values kept by the old roots are found by value too
+    for(std::size_t i = 0; i < values.size(); i += 2) tree.remove(values[i]);
+    for(std::size_t i = 1; i < values.size(); i += 2) tree.remove(handles[i]);
+    assert(tree.size() == 0 && tree.query(tree.m_tree_box).empty());
+}
+
+void QuadTree_GrowTest() {
+    using QT = QuadTree<Box<float>>;
+    std::vector<std::shared_ptr<TestObj>> values;
+    for(auto const& value: randomValues(3000, 2000)) {
+        Box<float> box = value->getBox();
+        values.push_back(std::make_shared<TestObj>(
+            Box<float>(box.left - 1000, box.top - 1000, box.width, box.height)
+        ));
+    }
+    
+    // Every doubling moves only the old root, even from a box of no round numbers
+    for(Box<float> start: { Box<float>(0, 0, 16, 16), Box<float>(0.1f, 0.3f, 3, 3) }) {
+        QT quadtree(start);
+        checkGrownTree(quadtree, values);
+        
+        QT loaded(start, values.begin(), values.end());
+        assert(loaded.m_tree_box.contains(Box<float>(-1000, -1000, 2000, 2000)));
+        assert(sortedBoxes(loaded.query(loaded.m_tree_box)) == sortedBoxes(values));
+    }
+    
+    QuadTree<Box<float>, float, QuadTreeLimits<16, 8, std::ratio<2>>> loose(Box<float>(0, 0, 16, 16));
+    checkGrownTree(loose, values);
+    
+    // Such a box is widened a little, round ones are kept as they are
+    Box<float> start(0.1f, 0.3f, 3, 3);
+    QT tight(start);
+    assert(tight.m_tree_box.contains(start));
+    assert(tight.m_tree_box.width < 3.01f && tight.m_tree_box.height < 3.01f);
+    assert(QT(Box<float>(-8, 0, 100, 1000)).m_tree_box == Box<float>(-8, 0, 100, 1000));
+    
+    // A doubling takes one block of the pool, the old nodes stay
+    for(auto const& value: randomValues(100, 3)) {
+        Box<float> box = value->getBox();
+        tight.add(std::make_shared<TestObj>(Box<float>(box.left / 4 + 0.2f, box.top / 4 + 0.4f, 0.1f, 0.1f)));
+    }
+    Box<float> old_box = tight.m_tree_box;
+    std::size_t nodes = tight.m_storage->pool.size();
+    auto old_values = sortedBoxes(tight.query(old_box));
+    tight.add(std::make_shared<TestObj>(Box<float>(-1000, -1000, 1, 1)));
+    std::size_t doublings = 0;
+    for(float width = old_box.width; width < tight.m_tree_box.width; width *= 2) ++doublings;
+    assert(doublings >= 9);
+    assert(tight.m_storage->pool.size() == nodes + doublings * 4);
+    assert(sortedBoxes(tight.query(old_box)) == old_values);
+    
+    QT moving(Box<float>(0, 0, 16, 16));
+    QuadTreeHandle handle = moving.insert(std::make_shared<TestObj>(Box<float>(1, 1, 1, 1)));
+    moving.update(handle, Box<float>(-500, 700, 1, 1));
+    assert(moving.query(Box<float>(-501, 699, 3, 3)).size() == 1);
+    
+    // A deferred merge of the old root moves with it to its quadrant
+    QT deferred(Box<float>(0, 0, 1000, 1000));
+    deferred.deferMerges(true);
+    auto straddler = std::make_shared<TestObj>(Box<float>(400, 400, 200, 200));
+    deferred.add(straddler);
+    for(int i = 0; i != 16; ++i) {
+        deferred.add(std::make_shared<TestObj>(Box<float>(float(i % 4) * 250 + 10, float(i / 4) * 250 + 10, 5, 5)));
+    }
+    assert(!deferred.root().isLeaf());
+    deferred.remove(straddler);
+    deferred.growToward(Box<float>(1500, 1500, 1, 1));
+    while(!deferred.compact(10)) { }
+    assert(deferred.root().isLeaf() && deferred.root().values().size() == 16);
+    
+    std::cout << "QuadTree grows toward the values out of it...\n";
+}
+
+void QuadTree_StatsTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(5000, 1000);
+    QT quadtree(world, values.begin(), values.end());
+    
+    QuadTreeStats stats = quadtree.stats();
+    // The root takes a whole block of the pool
+    assert(stats.nodes + 3 == quadtree.m_storage->pool.size());
+    assert(stats.root_values == quadtree.root().values().size());
+    assert(stats.overflowing_leaves == 0);
+    assert(stats.bytes > stats.nodes * sizeof(QT::NodeType));
+    std::size_t by_depth = 0, by_values = 0, values_count = 0;
+    for(std::size_t count: stats.depth_histogram) by_depth += count;
+    for(std::size_t k = 0; k != stats.values_histogram.size(); ++k) {
+        by_values += stats.values_histogram[k];
+        values_count += k * stats.values_histogram[k];
+    }
+    assert(by_depth == stats.nodes && by_values == stats.nodes);
+    assert(values_count == quadtree.size());
+    assert(stats.leaves * 4 == stats.nodes * 3 + 1);
+    assert(stats.depth_histogram.size() <= QT::NodeType::getMaxDepth() + 1);
+    
+    // Values piled in one spot overflow a leaf at the max depth
+    using Shallow = QuadTree<Box<float>, float, QuadTreeLimits<4, 2>>;
+    Shallow shallow(world);
+    for(int i = 0; i != 20; ++i) {
+        shallow.add(std::make_shared<TestObj>(Box<float>(10 + float(i), 10, 1, 1)));
+    }
+    QuadTreeStats shallow_stats = shallow.stats();
+    assert(shallow_stats.overflowing_leaves == 1);
+    assert(shallow_stats.depth_histogram.size() == 3);
+    assert(shallow_stats.values_histogram.size() == 21);
+    
+    // The counters cover one query and agree with its matches
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> coordinate(0, 900);
+    for(int q = 0; q != 50; ++q) {
+        Box<float> query_box(coordinate(random), coordinate(random), 100, 100);
+        std::size_t matches = quadtree.query(query_box).size();
+        QuadTreeQueryCounters counters = QT::lastQueryCounters();
+        assert(counters.matches == matches);
+        assert(counters.nodes_visited >= 1 && counters.nodes_visited <= stats.nodes);
+        assert(counters.boxes_tested >= matches);
+        
+        std::size_t visited = 0;
+        quadtree.queryVisit(query_box, [&visited] (QT::Value const&) { return ++visited < 3; });
+        assert(QT::lastQueryCounters().matches == visited);
+        assert(QT::lastQueryCounters().nodes_visited <= counters.nodes_visited);
+    }
+    quadtree.queryVisit(Box<float>(2000, 2000, 10, 10), [] (QT::Value const&) { return true; });
+    assert(QT::lastQueryCounters().nodes_visited == 0);
+    
+    std::cout << "QuadTree reports its shape and the work of a query...\n";
+}
+
+// Whether every node keeps at most twice the memory its values need
+template <class PoolT, class NodeT>
+bool tightArrays(PoolT const& pool, NodeT const& node) {
+    if(node.m_values.capacity() > 2 * node.m_values.size()) return false;
+    if(node.isLeaf()) return true;
+    for(int i = 0; i != 4; ++i) {
+        if(!tightArrays(pool, node.child(pool, i))) return false;
+    }
+    return true;
+}
+
+void QuadTree_CompactTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(5000, 1000);
+    QT eager(world), deferred(world);
+    deferred.deferMerges(true);
+    std::vector<QT::Handle> eager_handles, deferred_handles;
+    for(auto const& value: values) {
+        eager_handles.push_back(eager.insert(value));
+        deferred_handles.push_back(deferred.insert(value));
+    }
+    
+    // Removals and moves leave the nodes in place until compact()
+    std::size_t nodes = deferred.stats().nodes;
+    std::mt19937 random(8);
+    std::uniform_real_distribution<float> coordinate(0, 990);
+    for(std::size_t i = 0; i != values.size(); ++i) {
+        if(i % 10 == 0) {
+            Box<float> box(coordinate(random), coordinate(random), 5, 5);
+            eager.update(eager_handles[i], box);
+            deferred.update(deferred_handles[i], box);
+        } else if(i < 4000) {
+            eager.remove(eager_handles[i]);
+            deferred.remove(deferred_handles[i]);
+        }
+    }
+    // Values moved to emptied leaves of an oversized tree may split
+    // them once more, the tree never shrinks before compact()
+    assert(deferred.stats().nodes >= nodes);
+    assert(deferred.size() == eager.size());
+    
+    // Bounded steps per call reach the shape of the eager merges
+    std::size_t calls = 1;
+    while(!deferred.compact(10)) ++calls;
+    assert(calls > 1);
+    assert(deferred.compact(10));
+    assert(sameShape(deferred, eager));
+    assert(tightArrays(deferred.m_storage->pool, deferred.root()));
+    std::vector<QT::Handle> kept_handles;
+    std::vector<std::shared_ptr<TestObj>> kept_values;
+    for(std::size_t i = 0; i != values.size(); ++i) {
+        if(i % 10 == 0 || i >= 4000) {
+            kept_handles.push_back(deferred_handles[i]);
+            kept_values.push_back(values[i]);
+        }
+    }
+    checkHandleLocations(deferred, kept_handles, kept_values);
+    for(auto const& query: randomValues(100, 1000, 9)) {
+        assert(sortedBoxes(deferred.query(query->getBox())) == sortedBoxes(eager.query(query->getBox())));
+    }
+    
+    // Removal by value is deferred too
+    deferred.remove(values[4501]);
+    assert(!deferred.m_storage->dirty.empty());
+    deferred.compact(1000);
+    assert(deferred.m_storage->dirty.empty());
+    
+    // Growth from a box of no round numbers keeps the stale nodes for compact()
+    QT relaid(Box<float>(-0.1f, -0.3f, 1001, 1001));
+    relaid.deferMerges(true);
+    std::vector<QT::Handle> relaid_handles;
+    for(auto const& value: values) relaid_handles.push_back(relaid.insert(value));
+    for(std::size_t i = 0; i != 4000; ++i) relaid.remove(relaid_handles[i]);
+    assert(!relaid.m_storage->dirty.empty());
+    auto outside = std::make_shared<TestObj>(Box<float>(-10, 10, 1, 1));
+    int quadrant = 0;
+    Box<float> grown = relaid.doubledToward(outside->getBox(), quadrant);
+    assert(grown.quadrantByIndex(quadrant) == relaid.m_tree_box);
+    relaid.add(outside);
+    while(!relaid.compact(100)) { }
+    
+    std::vector<std::shared_ptr<TestObj>> relaid_values(values.begin() + 4000, values.end());
+    relaid_values.push_back(outside);
+    assert(relaid.size() == relaid_values.size());
+    for(auto const& query: randomValues(100, 1000, 10)) {
+        Box<float> query_box = query->getBox();
+        std::vector<Box<float>> expected;
+        for(auto const& value: relaid_values) {
+            if(query_box.intersects(value->getBox())) expected.push_back(value->getBox());
+        }
+        std::sort(expected.begin(), expected.end(), lessBox);
+        assert(sortedBoxes(relaid.query(query_box)) == expected);
+    }
+    
+    // Merges wait for half of the values to go, a split node survives
+    // adds and removes around the split threshold
+    using Hysteresis = QuadTree<Box<float>, float, QuadTreeLimits<16, 8, std::ratio<1>, 8>>;
+    QT plain(world);
+    Hysteresis sticky(world);
+    std::vector<QT::Handle> plain_handles, sticky_handles;
+    for(int i = 0; i != 17; ++i) {
+        auto value = std::make_shared<TestObj>(Box<float>(float(i % 4) * 250 + 10, float(i / 4) * 60 + 10, 5, 5));
+        plain_handles.push_back(plain.insert(value));
+        sticky_handles.push_back(sticky.insert(value));
+    }
+    assert(!plain.root().isLeaf() && !sticky.root().isLeaf());
+    plain.remove(plain_handles.back());
+    sticky.remove(sticky_handles.back());
+    assert(plain.root().isLeaf() && !sticky.root().isLeaf());
+    for(int i = 0; i != 8; ++i) sticky.remove(sticky_handles[static_cast<std::size_t>(i)]);
+    assert(sticky.root().isLeaf() && sticky.size() == 8);
+    
+    std::cout << "QuadTree defers merges to a budgeted compaction...\n";
+}
+
+void QuadTree_ApplyTest() {
+    using QT = QuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(5000, 1000);
+    auto added = randomValues(4000, 1000, 5);
+    // Some added values make the tree grow
+    added.push_back(std::make_shared<TestObj>(Box<float>(1500, 200, 10, 10)));
+    added.push_back(std::make_shared<TestObj>(Box<float>(-300, 1200, 20, 5)));
+    
+    std::vector<QT::ValPtr> adds(added.begin(), added.end()), removes;
+    for(std::size_t i = 0; i < values.size(); i += 3) removes.push_back(values[i]);
+    
+    // One batch gives the tree of the same removals and adds one by one
+    QT batched(world), sequential(world);
+    std::vector<QT::Handle> handles;
+    for(auto const& value: values) {
+        handles.push_back(batched.insert(value));
+        sequential.add(value);
+    }
+    for(auto const& value: removes) sequential.remove(value);
+    for(auto const& value: adds) sequential.add(value);
+    auto added_handles = batched.apply(adds, removes, 4);
+    
+    assert(batched.size() == sequential.size());
+    assert(batched.m_tree_box == sequential.m_tree_box);
+    assert(sameShape(batched, sequential));
+    checkHandleLocations(batched, added_handles, added);
+    std::vector<QT::Handle> kept_handles;
+    std::vector<std::shared_ptr<TestObj>> kept_values;
+    for(std::size_t i = 0; i != values.size(); ++i) {
+        if(i % 3 != 0) {
+            kept_handles.push_back(handles[i]);
+            kept_values.push_back(values[i]);
+        }
+    }
+    checkHandleLocations(batched, kept_handles, kept_values);
+    for(auto const& query: randomValues(100, 1000, 9)) {
+        assert(sortedBoxes(batched.query(query->getBox())) == sortedBoxes(sequential.query(query->getBox())));
+    }
+    
+    // Removing everything merges down to the root, a deferred batch
+    // leaves the merges to compact()
+    batched.apply({}, adds, 4);
+    assert(batched.size() == kept_values.size());
+    batched.apply({}, std::vector<QT::ValPtr>(kept_values.begin(), kept_values.end()), 4);
+    QT deferred(world, values.begin(), values.end());
+    deferred.deferMerges(true);
+    deferred.apply({}, std::vector<QT::ValPtr>(values.begin(), values.end()), 1);
+    assert(!deferred.root().isLeaf() && !deferred.m_storage->dirty.empty());
+    while(!deferred.compact(100)) { }
+    for(QT* tree: { &batched, &deferred }) {
+        assert(tree->size() == 0 && tree->root().isLeaf());
+        assert(tree->m_storage->pool.size() == 4);
+    }
+    
+    // Growth pushes interior nodes past the max depth, below the levels
+    // the keys hold: the batch still reaches their children
+    using Shallow = QuadTree<Box<float>, float, QuadTreeLimits<2, 4>>;
+    Box<float> small_world(0, 0, 1024, 1024);
+    auto small_values = randomValues(300, 1024, 11);
+    Shallow grown(small_world), grown_sequential(small_world);
+    for(auto const& value: small_values) {
+        grown.add(value);
+        grown_sequential.add(value);
+    }
+    Box<float> outside(1500, 100, 10, 10);
+    grown.growToward(outside);
+    grown_sequential.growToward(outside);
+    assert(grown.stats().depth_histogram.size() > Shallow::NodeType::getMaxDepth() + 1);
+    
+    auto small_adds = randomValues(200, 1024, 12);
+    std::vector<QT::ValPtr> small_removes;
+    for(std::size_t i = 0; i < small_values.size(); i += 4) small_removes.push_back(small_values[i]);
+    grown.apply(std::vector<QT::ValPtr>(small_adds.begin(), small_adds.end()), small_removes, 4);
+    for(auto const& value: small_removes) grown_sequential.remove(value);
+    for(auto const& value: small_adds) grown_sequential.add(value);
+    
+    // Nodes past the max depth never split again once merged, so there the
+    // shape depends on the order of the merges and the adds: the queries agree
+    for(auto const& query: randomValues(100, 1024, 13)) {
+        assert(sortedBoxes(grown.query(query->getBox())) == sortedBoxes(grown_sequential.query(query->getBox())));
+    }
+    
+    // Every value is found by its box again
+    std::vector<std::shared_ptr<TestObj>> grown_values(small_adds);
+    for(std::size_t i = 0; i != small_values.size(); ++i) {
+        if(i % 4 != 0) grown_values.push_back(small_values[i]);
+    }
+    assert(sortedBoxes(grown.query(grown.m_tree_box)) == sortedBoxes(grown_values));
+    for(auto const& value: grown_values) grown.remove(value);
+    assert(grown.size() == 0 && grown.root().isLeaf());
+    
+    std::cout << "QuadTree applies batches of adds and removes in one descent...\n";
+}
+
+void PagedQuadTree_Test() {
+    // Small pages and a budget far below the size of the tree
+    using PT = PagedQuadTree<std::uint32_t, float, 512, 10>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(20000, 1000);
+    PT paged(world, "quadtree_test.pages", 128 * 512, 2);
+    for(std::size_t i = 0; i != values.size(); ++i) {
+        paged.add(values[i]->getBox(), static_cast<std::uint32_t>(i));
+    }
+    assert(paged.size() == values.size());
+    
+    auto brute = [&values] (Box<float> const& query_box, std::vector<bool> const& removed) {
+        std::vector<std::uint32_t> ids;
+        for(std::size_t i = 0; i != values.size(); ++i) {
+            if(!removed[i] && query_box.intersects(values[i]->getBox())) {
+                ids.push_back(static_cast<std::uint32_t>(i));
+            }
+        }
+        return ids;
+    };
+    auto check = [&] (std::vector<bool> const& removed, unsigned seed) {
+        for(auto const& query: randomValues(50, 1000, seed)) {
+            Box<float> box = query->getBox();
+            Box<float> query_box(box.left, box.top, box.width + 30, box.height + 30);
+            std::vector<std::uint32_t> ids = paged.query(query_box);
+            std::sort(ids.begin(), ids.end());
+            assert(ids == brute(query_box, removed));
+        }
+    };
+    std::vector<bool> removed(values.size(), false);
+    check(removed, 3);
+    
+    // Pages went to the file and came back within the budget
+    PagedQuadTreeStats stats = paged.stats();
+    assert(stats.misses > 0 && stats.writes > 0);
+    assert(stats.resident_pages >= 5);
+    assert(stats.resident_pages + stats.cached_pages <= 128);
+    assert(paged.m_page_count > 1000);
+    
+    // A hot region is served from the cache
+    Box<float> hot(100, 100, 20, 20);
+    std::vector<std::uint32_t> hot_ids = paged.query(hot);
+    std::size_t misses = paged.stats().misses;
+    for(int q = 0; q != 10; ++q) assert(paged.query(hot) == hot_ids);
+    assert(paged.stats().misses == misses);
+    
+    for(std::size_t i = 0; i < values.size(); i += 2) {
+        paged.remove(values[i]->getBox(), static_cast<std::uint32_t>(i));
+        removed[i] = true;
+    }
+    assert(paged.size() == values.size() / 2);
+    check(removed, 4);
+    
+    // Emptied nodes merge back into the root
+    for(std::size_t i = 1; i < values.size(); i += 2) {
+        paged.remove(values[i]->getBox(), static_cast<std::uint32_t>(i));
+    }
+    assert(paged.size() == 0);
+    assert(paged.query(world).empty());
+    assert(paged.page(0).isLeaf() && paged.page(0).next == PT::Page::null);
+    assert(!paged.failed());
+    
+    // A page file cut under the tree fails its reads, queries end
+    // on the pages not read instead of following their bytes
+    {
+        PT cut(world, "quadtree_test.cut.pages", 16 * 512, 1);
+        for(std::size_t i = 0; i != 5000; ++i) cut.add(values[i]->getBox(), static_cast<std::uint32_t>(i));
+        assert(!cut.failed());
+        std::ofstream("quadtree_test.cut.pages", std::ios::binary | std::ios::trunc);
+        assert(cut.query(world).size() < 5000);
+        assert(cut.failed());
+    }
+    
+    // So does a page file that cannot be created
+    PT nowhere(world, "no_such_directory/quadtree_test.pages", 4 * 512, 1);
+    assert(nowhere.failed());
+    for(std::size_t i = 0; i != 1000; ++i) nowhere.add(values[i]->getBox(), static_cast<std::uint32_t>(i));
+    assert(nowhere.query(world).size() <= 1000);
+    
+    std::cout << "PagedQuadTree keeps deep pages on disk behind an LRU cache...\n";
+}
+
+void SnapshotQuadTree_Test() {
+    using ST = SnapshotQuadTree<Box<float>>;
+    Box<float> world(0, 0, 1000, 1000);
+    auto values = randomValues(5000, 1000);
+    std::vector<ST::ValPtr> all(values.begin(), values.end());
+    std::vector<ST::ValPtr> removes;
+    for(std::size_t i = 0; i < values.size(); i += 3) removes.push_back(values[i]);
+    
+    // Same queries as QuadTree after adds and removes
+    ST tree(world);
+    QuadTree<Box<float>> plain(world);
+    for(auto const& value: values) {
+        tree.add(value);
+        plain.add(value);
+    }
+    auto before = tree.snapshot();
+    for(auto const& value: removes) {
+        tree.remove(value);
+        plain.remove(value);
+    }
+    auto after = tree.snapshot();
+    assert(after.size() == plain.size() && after.version() > before.version());
+    for(auto const& query: randomValues(100, 1000, 9)) {
+        assert(sortedBoxes(after.query(query->getBox())) == sortedBoxes(plain.query(query->getBox())));
+    }
+    
+    // Values are visited like QuadTree::queryVisit() does it
+    std::size_t visited = 0;
+    assert(!after.queryVisit(world, [&visited, &world] (ST::Value const& value) {
+        assert(world.contains(value.getBox()));
+        return ++visited != 10;
+    }));
+    assert(visited == 10);
+    
+    // The pinned version stays whole while the writer goes on
+    assert(before.size() == values.size());
+    assert(sortedBoxes(before.query(world)) == sortedBoxes(values));
+    assert(tree.retiredNodes() > 0);
+    
+    // A mutation copies only its path, the other subtrees are shared
+    tree.add(std::make_shared<TestObj>(Box<float>(10, 10, 1, 1)));
+    auto added = tree.snapshot();
+    assert(added.m_root != after.m_root);
+    assert(added.m_root->children[0] != after.m_root->children[0]);
+    for(std::size_t i = 1; i != 4; ++i) assert(added.m_root->children[i] == after.m_root->children[i]);
+    
+    // Old nodes are freed once no snapshot pins them
+    { auto released = std::move(before); }
+    { auto released = std::move(after); }
+    { auto released = std::move(added); }
+    tree.reclaim();
+    assert(tree.retiredNodes() == 0);
+    
+    // Readers see whole versions while one writer applies batches
+    ST shared(world, 4);
+    std::atomic<bool> done { false };
+    std::thread writer([&] {
+        for(int round = 0; round != 20; ++round) {
+            shared.apply(all, {});
+            shared.apply({}, all);
+        }
+        done.store(true);
+    });
+    std::vector<std::thread> readers;
+    for(int r = 0; r != 3; ++r) {
+        readers.emplace_back([&] {
+            std::uint64_t last_version = 0;
+            while(!done.load()) {
+                auto snapshot = shared.snapshot();
+                assert(snapshot.size() == 0 || snapshot.size() == values.size());
+                assert(snapshot.query(world).size() == snapshot.size());
+                assert(snapshot.version() >= last_version);
+                last_version = snapshot.version();
+            }
+        });
+    }
+    writer.join();
+    for(auto& thread: readers) thread.join();
+    shared.reclaim();
+    assert(shared.size() == 0 && shared.retiredNodes() == 0);
+    
+    std::cout << "SnapshotQuadTree readers query pinned versions without locks...\n";
+}
+
+void PointQuadTree_Test() {
+    using PQT = PointQuadTree<int>;
+    Box<float> world(0, 0, 1000, 1000);
+    std::mt19937 random(4);
+    std::uniform_real_distribution<float> coordinate(0, 1000);
+    std::vector<Vector2<float>> points;
+    for(int i = 0; i != 5000; ++i) {
+        // Some points repeat, they pile up in leaves at the depth limit
+        if(i % 100 == 99) points.push_back(points[static_cast<std::size_t>(i / 2)]);
+        else points.emplace_back(coordinate(random), coordinate(random));
+    }
+    
+    PQT tree(world);
+    for(std::size_t i = 0; i != points.size(); ++i) tree.add(points[i], static_cast<int>(i));
+    assert(tree.size() == points.size());
+    
+    auto check = [&] (std::vector<bool> const& present) {
+        for(auto const& query: randomValues(100, 1000, 15)) {
+            Box<float> query_box = query->getBox();
+            std::vector<int> expected;
+            for(std::size_t i = 0; i != points.size(); ++i) {
+                if(present[i] && query_box.intersects(Box<float>(points[i], Vector2<float>()))) {
+                    expected.push_back(static_cast<int>(i));
+                }
+            }
+            std::vector<int> found;
+            for(int value: tree.query(query_box)) found.push_back(value);
+            std::sort(found.begin(), found.end());
+            assert(found == expected);
+            
+            Vector2<float> center = query_box.getCenter();
+            std::vector<float> distances;
+            for(std::size_t i = 0; i != points.size(); ++i) {
+                float dx = points[i].x - center.x, dy = points[i].y - center.y;
+                if(present[i]) distances.push_back(dx * dx + dy * dy);
+            }
+            std::sort(distances.begin(), distances.end());
+            auto nearest = tree.nearest(center, 7);
+            for(std::size_t k = 0; k != nearest.size(); ++k) {
+                Vector2<float> point = points[static_cast<std::size_t>(nearest[k].get())];
+                float dx = point.x - center.x, dy = point.y - center.y;
+                assert(!(dx * dx + dy * dy < distances[k]) && !(dx * dx + dy * dy > distances[k]));
+            }
+        }
+    };
+    std::vector<bool> present(points.size(), true);
+    check(present);
+    
+    for(std::size_t i = 0; i < points.size(); i += 2) {
+        tree.remove(points[i], static_cast<int>(i));
+        present[i] = false;
+    }
+    check(present);
+    
+    for(std::size_t i = 1; i < points.size(); i += 2) tree.remove(points[i], static_cast<int>(i));
+    assert(tree.size() == 0 && tree.m_pool->size() == 4);
+    
+    std::cout << "PointQuadTree keeps points in leaves...\n";
+}
+
 void QuadTreeTests() {
+    BoxArray_IntersectTest<float>();
+    BoxArray_IntersectTest<double>();
+    std::cout << "BoxArray vector kernel matches Box::intersects...\n";
     QuadTree_CreateTest();
     Box_GetQuadrantIndexTest ();
     Box_GetQuadrantByIndexTest ();
@@ -494,6 +1904,194 @@ void QuadTreeTests() {
     QuadTree_RemoveValuesTest();
     QuadTree_MergeTest();
     QuadTree_IntersectTest();
+    QuadTree_BulkLoadTest();
+    QuadTree_QueryBatchTest();
+    QuadTree_QueryVisitTest();
+    QuadTree_NodePoolTest();
+    LinearQuadTree_FreezeTest();
+    MappedQuadTree_SaveTest();
+    QuadTree_HandleRemoveTest();
+    QuadTree_UpdateTest();
+    QuadTree_LimitsTest();
+    QuadTree_NearestTest();
+    QuadTree_RaycastTest();
+    QuadTree_OverlappingPairsTest();
+    QuadTree_SpatialJoinTest();
+    QuadTree_LooseTest();
+    QuadTree_GrowTest();
+    QuadTree_StatsTest();
+    QuadTree_CompactTest();
+    QuadTree_ApplyTest();
+    PointQuadTree_Test();
+    PagedQuadTree_Test();
+    SnapshotQuadTree_Test();
+    ValueQuadTree_Test();
+}
+
+void QuadTreeParallel_AddRemoveTest() {
+    using QT = QuadTreeParallel<Box<float>>;
+    QT quadtree(Box<float>(0, 0, 100, 100));
+    
+    using ViB = ValueInBox<Box<float>>;
+    class TreeObj: public ViB, public ClonableDerived<TreeObj, ViB> {
+      public:
+        explicit TreeObj(Box box): value(box) { }
+        Box getBox() const override { return value; }
+        Box& getValue() override { return value; }
+      
+      private:
+        Box value;
+    };
+    
+    std::vector<std::shared_ptr<TreeObj>> values = {
+        std::make_shared<TreeObj>(Box<float>{10, 10, 10, 10}),
+        std::make_shared<TreeObj>(Box<float>{60, 10, 10, 10}),
+        std::make_shared<TreeObj>(Box<float>{10, 60, 10, 10}),
+        std::make_shared<TreeObj>(Box<float>{60, 60, 10, 10}),
+    };
+    
+    for(int i = 0; i != 5; ++i) {
+        for(auto const& value: values) {
+            quadtree.add(value);
+        }
+    }
+    
+    assert(!quadtree.m_root_node->isLeaf());
+    assert(quadtree.query(Box<float>(15, 15, 50, 1)).size() == 10);
+    
+    for(auto const& value: values) {
+        quadtree.remove(value);
+    }
+    
+    assert(quadtree.m_root_node->isLeaf());
+    assert(quadtree.m_root_node->m_values.size() == 16);
+    
+    // Limits reach the nodes like in QuadTree
+    QuadTreeParallel<Box<float>, float, QuadTreeLimits<4, 2>> small(Box<float>(0, 0, 100, 100));
+    for(int i = 0; i != 5; ++i) {
+        for(auto const& value: values) small.add(value);
+    }
+    // Past the max depth a leaf keeps more than the max values count
+    assert(!small.m_root_node->isLeaf() && !small.m_root_node->child(0)->isLeaf());
+    assert(small.m_root_node->child(0)->child(0)->isLeaf());
+    assert(small.m_root_node->child(0)->child(0)->m_values.size() == 5);
+    for(int i = 0; i != 5; ++i) {
+        for(auto const& value: values) small.remove(value);
+    }
+    assert(small.m_root_node->isLeaf() && small.m_root_node->m_values.empty());
+    
+    std::cout << "QuadTreeParallel add and remove work like QuadTree...\n";
+}
+
+void QuadTreeParallel_ConcurrentTest() {
+    using QT = QuadTreeParallel<Box<float>>;
+    QT quadtree(Box<float>(0, 0, 1000, 1000));
+    
+    using ViB = ValueInBox<Box<float>>;
+    class TreeObj: public ViB, public ClonableDerived<TreeObj, ViB> {
+      public:
+        explicit TreeObj(Box box): value(box) { }
+        Box getBox() const override { return value; }
+        Box& getValue() override { return value; }
+      
+      private:
+        Box value;
+    };
+    
+    // Every writer owns a vertical stripe, so the final content is known
+    int const writers = 4;
+    int const per_writer = 500;
+    auto make_value = [] (int writer, int i) {
+        float x = static_cast<float>(writer * 250 + (i % 24) * 10);
+        float y = static_cast<float>((i / 24) * 40 + (i % 3));
+        return std::make_shared<TreeObj>(Box<float>(x, y, 5, 5));
+    };
+    
+    std::atomic<bool> stop { false };
+    std::vector<std::thread> threads;
+    for(int w = 0; w != writers; ++w) {
+        threads.emplace_back([&, w] {
+            for(int round = 0; round != 2; ++round) {
+                for(int i = 0; i != per_writer; ++i) quadtree.add(make_value(w, i));
+                if(round == 0) {
+                    for(int i = 0; i != per_writer; ++i) quadtree.remove(make_value(w, i));
+                }
+            }
+        });
+    }
+    
+    std::vector<std::thread> readers;
+    for(int r = 0; r != 4; ++r) {
+        readers.emplace_back([&] {
+            while(!stop) {
+                for(auto const& value: quadtree.query(Box<float>(0, 0, 1000, 1000))) {
+                    assert(Box<float>(0, 0, 1000, 1000).contains(value->getBox()));
+                }
+            }
+        });
+    }
+    
+    for(auto& thread: threads) thread.join();
+    stop = true;
+    for(auto& thread: readers) thread.join();
+    
+    auto all = quadtree.query(Box<float>(0, 0, 1000, 1000));
+    assert(all.size() == static_cast<std::size_t>(writers * per_writer));
+    for(int w = 0; w != writers; ++w) {
+        auto stripe = quadtree.query(Box<float>(static_cast<float>(w * 250), 0, 249, 1000));
+        assert(stripe.size() == static_cast<std::size_t>(per_writer));
+    }
+    
+    std::cout << "QuadTreeParallel concurrent add, remove and query work...\n";
+}
+
+void StripedSharedSpinMutex_Test() {
+    StripedSharedSpinMutex mutex;
+    auto busy_stripes = [&mutex] {
+        std::size_t busy = 0;
+        for(auto const& stripe: mutex.m_stripes) busy += stripe.readers.load() != 0;
+        return busy;
+    };
+    
+    // Readers of different threads count in different stripes,
+    // the writer flag they share is only read
+    std::size_t const readers = 4;
+    std::atomic<std::size_t> locked { 0 };
+    std::atomic<bool> release { false };
+    std::vector<std::thread> threads;
+    for(std::size_t r = 0; r != readers; ++r) {
+        threads.emplace_back([&] {
+            mutex.lock_shared();
+            ++locked;
+            while(!release) std::this_thread::yield();
+            mutex.unlock_shared();
+        });
+    }
+    while(locked != readers) std::this_thread::yield();
+    assert(busy_stripes() == readers);
+    assert(!mutex.m_writer.load());
+    
+    // The writer waits for every stripe to empty
+    std::atomic<bool> written { false };
+    std::thread writer([&] {
+        mutex.lock();
+        written = true;
+        mutex.unlock();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(!written);
+    release = true;
+    for(auto& thread: threads) thread.join();
+    writer.join();
+    assert(written && busy_stripes() == 0);
+    
+    std::cout << "StripedSharedSpinMutex readers write stripes of their own...\n";
+}
+
+void QuadTreeParallelTests() {
+    StripedSharedSpinMutex_Test();
+    QuadTreeParallel_AddRemoveTest();
+    QuadTreeParallel_ConcurrentTest();
 }
 
 void runTests() {
@@ -503,6 +2101,7 @@ void runTests() {
     QuadTreeTests();
     
     std::cout << "\n *** Parallel QuadTree test ***\n";
+    QuadTreeParallelTests();
     
     std::cout << "All right\n";
     #endif
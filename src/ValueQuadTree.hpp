@@ -0,0 +1,249 @@
+//
+// Created by Aeomanate on 17.10.2026.
+//
+
+#ifndef QUADTREE_VALUEQUADTREE_HPP
+#define QUADTREE_VALUEQUADTREE_HPP
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "Box.hpp"
+#include "NodePool.hpp"
+#include "QuadTreeLimits.hpp"
+
+// Default BoxOf: the value knows its box
+template <class T, class Real>
+struct MemberBoxOf {
+    Box<Real> operator()(T const& value) const {
+        return value.getBox();
+    }
+};
+
+// Node of ValueQuadTree. Values are stored by value next to their boxes:
+// no clone per insert, no virtual getBox() or getValue() per visit.
+template <class T, class Real>
+class ValueNode {
+  public:
+    using Pool = NodePool<ValueNode>;
+    using Index = typename Pool::Index;
+    using Box = ::Box<Real>;
+    
+    struct Entry {
+        Box box;
+        T value;
+    };
+    
+  public:
+    bool isLeaf() const {
+        return m_first_child == Pool::null;
+    }
+    
+    Index childIndex(int i) const {
+        return m_first_child + static_cast<Index>(i);
+    }
+    
+    std::vector<Entry> const& entries() const {
+        return m_entries;
+    }
+    
+  private:
+    template <class, class, class, class>
+    friend class ValueQuadTree;
+    
+    Index m_first_child = Pool::null;
+    std::vector<Entry> m_entries;
+};
+
+// QuadTree which owns its values. BoxOf gives the box of a value,
+// it is called once per add() and once per remove().
+// Same cells and limits as QuadTree.
+template <class T, class Real = float, class BoxOf = MemberBoxOf<T, Real>, class Limits = QuadTreeLimits<>>
+class ValueQuadTree {
+  private:
+    using NodeType = ValueNode<T, Real>;
+    using Pool = typename NodeType::Pool;
+    using Index = typename NodeType::Index;
+    using Entry = typename NodeType::Entry;
+    
+  public:
+    using Box = ::Box<Real>;
+    using Quadrants = typename Box::Quadrants;
+    
+  public:
+    explicit ValueQuadTree(Box tree_box, BoxOf box_of = BoxOf())
+    : m_tree_box(tree_box)
+    , m_box_of(box_of)
+    , m_pool(new Pool())
+    {
+        // The root is the first node of the first block
+        m_pool->allocateBlock();
+    }
+    
+    void add(T value) {
+        Box box = m_box_of(value);
+        assert(bounds(m_tree_box).contains(box));
+        Index index = 0;
+        Box cell = m_tree_box;
+        std::size_t depth = 0;
+        while (true) {
+            NodeType& node = (*m_pool)[index];
+            if (node.isLeaf()) {
+                if (depth >= Limits::max_depth || node.m_entries.size() < Limits::max_values) break;
+                split(node, cell);
+            }
+            Quadrants i = childFor(cell, box);
+            if (i == Quadrants::NEITHER_ONE_QUADRANT) break;
+            index = node.childIndex(i);
+            cell = cell.quadrantByIndex(i);
+            ++depth;
+        }
+        (*m_pool)[index].m_entries.push_back(Entry { box, std::move(value) });
+        ++m_size;
+    }
+    
+    // Removes a value equal to the given one
+    void remove(T const& value) {
+        Box box = m_box_of(value);
+        assert(bounds(m_tree_box).contains(box));
+        // Path from the root for the merges, only leaves lie at the max depth
+        std::array<Index, Limits::max_depth + 1> path;
+        std::size_t depth = 0;
+        path[0] = 0;
+        Box cell = m_tree_box;
+        while (!(*m_pool)[path[depth]].isLeaf()) {
+            Quadrants i = childFor(cell, box);
+            if (i == Quadrants::NEITHER_ONE_QUADRANT) break;
+            path[depth + 1] = (*m_pool)[path[depth]].childIndex(i);
+            cell = cell.quadrantByIndex(i);
+            ++depth;
+        }
+        
+        NodeType& owner = (*m_pool)[path[depth]];
+        auto found = std::find_if(
+            owner.m_entries.begin(), owner.m_entries.end(),
+            [&box, &value] (Entry const& entry) {
+                return entry.box == box && entry.value == value;
+            }
+        );
+        assert(found != owner.m_entries.end() &&
+               "Trying to remove a value that is not present in the tree");
+        
+        *found = std::move(owner.m_entries.back());
+        owner.m_entries.pop_back();
+        --m_size;
+        
+        // An interior node that lost a value may merge itself
+        std::size_t merging = owner.isLeaf() ? depth : depth + 1;
+        while (merging != 0 && tryMerge((*m_pool)[path[merging - 1]])) {
+            --merging;
+        }
+    }
+    
+    std::size_t size() const {
+        return m_size;
+    }
+    
+    // References stay valid until the tree is modified
+    std::vector<std::reference_wrapper<T const>> query(Box const& query_box) const {
+        std::vector<std::reference_wrapper<T const>> match_values;
+        queryVisit(query_box, [&match_values] (T const& value) {
+            match_values.push_back(std::cref(value));
+            return true;
+        });
+        return match_values;
+    }
+    
+    // Calls callback(T const&) for the values intersecting query_box
+    // until it returns false. Returns false if the callback stopped the query.
+    template <class Callback>
+    bool queryVisit(Box const& query_box, Callback callback) const {
+        if (!query_box.intersects(bounds(m_tree_box))) return true;
+        return visit(0, m_tree_box, query_box, callback);
+    }
+    
+  private:
+    // Same cells as Node::bounds() and Node::childFor()
+    static Box bounds(Box const& cell) {
+        return looseBox<typename Limits::looseness>(cell);
+    }
+    
+    static Quadrants childFor(Box const& cell, Box const& box) {
+        if (Limits::looseness::num == Limits::looseness::den) return cell.quadrantIndex(box);
+        
+        Vector2<Real> center = box.getCenter();
+        Quadrants i = cell.quadrantIndex(Box(center.x, center.y, 0, 0));
+        if (i != Quadrants::NEITHER_ONE_QUADRANT && bounds(cell.quadrantByIndex(i)).contains(box)) {
+            return i;
+        }
+        return Quadrants::NEITHER_ONE_QUADRANT;
+    }
+    
+    void split(NodeType& node, Box const& cell) {
+        assert(node.isLeaf() && "Only leaves can be split");
+        Index first_child = m_pool->allocateBlock();
+        node.m_first_child = first_child;
+        
+        std::vector<Entry> entries = std::move(node.m_entries);
+        node.m_entries.clear();
+        for (Entry& entry: entries) {
+            Quadrants i = childFor(cell, entry.box);
+            NodeType& target = i == Quadrants::NEITHER_ONE_QUADRANT ? node : (*m_pool)[node.childIndex(i)];
+            target.m_entries.push_back(std::move(entry));
+        }
+    }
+    
+    // Returns true if the children were merged into the node
+    bool tryMerge(NodeType& node) {
+        assert(!node.isLeaf() && "Only interior nodes can be merged");
+        std::size_t count = node.m_entries.size();
+        for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+            NodeType const& child = (*m_pool)[node.childIndex(i)];
+            if (!child.isLeaf()) return false;
+            count += child.m_entries.size();
+        }
+        if (count > Limits::merge_values) return false;
+        
+        node.m_entries.reserve(count);
+        for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+            for (Entry& entry: (*m_pool)[node.childIndex(i)].m_entries) {
+                node.m_entries.push_back(std::move(entry));
+            }
+        }
+        m_pool->freeBlock(node.m_first_child);
+        node.m_first_child = Pool::null;
+        return true;
+    }
+    
+    template <class Callback>
+    bool visit(Index index, Box const& cell, Box const& query_box, Callback& callback) const {
+        NodeType const& node = (*m_pool)[index];
+        for (Entry const& entry: node.m_entries) {
+            if(query_box.intersects(entry.box) && !callback(entry.value)) {
+                return false;
+            }
+        }
+        
+        if(!node.isLeaf()) {
+            for (int i = 0; i != static_cast<int>(Pool::BlockSize); ++i) {
+                Box child_box = cell.quadrantByIndex(i);
+                if(query_box.intersects(bounds(child_box)) &&
+                   !visit(node.childIndex(i), child_box, query_box, callback)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    
+  private:
+    Box m_tree_box;
+    BoxOf m_box_of;
+    // Owns every node of the tree
+    std::unique_ptr<Pool> m_pool;
+    std::size_t m_size = 0;
+};
+
+#endif // QUADTREE_VALUEQUADTREE_HPP